@@ -43,6 +43,17 @@ macro(bd_sys_lib target name)
   target_link_libraries(${ARGV0} ${ARGV1})
 endmacro(bd_sys_lib)
 
+# Optional LZ4, defines HAVE_LZ4 and links it when the library is installed
+macro(bd_use_lz4 target)
+  find_path(LZ4_INCLUDE_DIR lz4.h)
+  find_library(LZ4_LIBRARY lz4)
+  if (LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+    target_compile_definitions(${ARGV0} PRIVATE HAVE_LZ4)
+    target_include_directories(${ARGV0} PRIVATE ${LZ4_INCLUDE_DIR})
+    target_link_libraries(${ARGV0} ${LZ4_LIBRARY})
+  endif (LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+endmacro(bd_use_lz4)
+
 set(CMAKE_CXX_STANDARD 14)
 set(CMAKE_CXX_STANDARD_REQUIRED ON)
 set(CMAKE_CXX_EXTENSIONS OFF)
@@ -56,6 +56,20 @@ namespace bdfs
     return session->Call(this->path, method, args, body, len, callback);
   }
 
+  bool BdObject::Call(const char * method, CArgs & args, ReceiveBufferPtr buffer, BufferCallback callback, uint32_t timeout)
+  { 
+    std::shared_ptr<BdSession> session = BdSession::GetSession(base);
+    if (session.get() == NULL) { return false; }
+    return session->Call(this->path, method, args, std::move(buffer), callback, timeout);
+  }
+
+  bool BdObject::Call(const char * method, CArgs & args, SendBufferPtr body, Callback callback, uint32_t timeout)
+  { 
+    std::shared_ptr<BdSession> session = BdSession::GetSession(base);
+    if (session.get() == NULL) { return false; }
+    return session->Call(this->path, method, args, std::move(body), callback, timeout);
+  }
+
 
   uint32_t BdObject::GetTimeout() const
   {
@@ -63,4 +77,20 @@ namespace bdfs
     if (session.get() == NULL) { return 1; }
     return session->GetTimeout();
   }
+
+
+  uint32_t BdObject::GetDeadline() const
+  {
+    std::shared_ptr<BdSession> session = BdSession::GetSession(base);
+    if (session.get() == NULL) { return 1; }
+    return session->GetDeadline();
+  }
+
+
+  uint32_t BdObject::GetBlockTimeout() const
+  {
+    std::shared_ptr<BdSession> session = BdSession::GetSession(base);
+    if (session.get() == NULL) { return 1; }
+    return session->GetBlockTimeout();
+  }
 }
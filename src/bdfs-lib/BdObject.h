@@ -26,6 +26,8 @@
 #include <map>
 #include <functional>
 #include "json/json.h"
+#include "ReceiveBuffer.h"
+#include "SendBuffer.h"
 
 namespace bdfs
 {
@@ -35,6 +37,7 @@ namespace bdfs
     typedef std::map<std::string, Json::Value> CArgs;
     typedef std::function<void(Json::Value&, bool)> Callback;
     typedef std::function<void(std::string &&, bool)> RawCallback;
+    typedef std::function<void(size_t, bool)> BufferCallback;
 
   private:
     std::string base;
@@ -58,7 +61,12 @@ namespace bdfs
     bool Call(const char * method, CArgs & args, Callback callback);
     bool Call(const char * method, CArgs & args, RawCallback callback);
     bool Call(const char * method, CArgs & args, const void * body, size_t len, Callback callback);
+    // A non zero timeout is the deadline of each attempt in milliseconds
+    bool Call(const char * method, CArgs & args, ReceiveBufferPtr buffer, BufferCallback callback, uint32_t timeout = 0);
+    bool Call(const char * method, CArgs & args, SendBufferPtr body, Callback callback, uint32_t timeout = 0);
 
     uint32_t GetTimeout() const;
+    uint32_t GetDeadline() const;
+    uint32_t GetBlockTimeout() const;
   };
 }
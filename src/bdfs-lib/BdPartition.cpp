@@ -25,6 +25,9 @@
 #include "Base64Encoder.h"
 #include "BdPartition.h"
 
+#include <string.h>
+#include <atomic>
+
 namespace bdfs
 {
   BD_TYPE_REG(Partition, BdPartition);
@@ -32,21 +35,45 @@ namespace bdfs
 
   BdPartition::BdPartition(const char * base, const char * name, const char * path, const char * type)
     : BdObject(base, name, path, type)
+    , latency(LatencyTracker::Get(base))
+    , health(HostHealth::Get(base))
   {
   }
 
 
-  AsyncResultPtr<ssize_t> BdPartition::Write(uint64_t blockId, uint32_t offset, const void * data, uint32_t size)
+  AsyncResultPtr<ssize_t> BdPartition::Write(uint64_t blockId, uint32_t offset, SendBufferPtr body)
   {
+    if (!body || body->Size() == 0 || !this->health->Allow())
+    {
+      return nullptr;
+    }
+
     BdObject::CArgs args;
     args["block"] = Json::Value::UInt(blockId);
     args["offset"] = Json::Value::UInt(offset);
 
     auto result = std::make_shared<AsyncResult<ssize_t>>();
+    auto latency = this->latency;
+    StopWatch watch;
 
-    bool rtn = this->Call("WriteBlock", args, data, size,
-      [result](Json::Value & response, bool error)
+#if !defined(_WIN32)
+    if (this->blockClient && this->blockClient->IsAvailable() &&
+        this->blockClient->WriteBlock(this->Name(), blockId, offset, *body, 0, static_cast<uint32_t>(body->Size()),
+          [result, latency, watch](BlockProtocol::Status status, uint32_t written, std::string &&)
+          {
+            latency->Record(watch.ElapsedMicros(), status == BlockProtocol::Status::Ok);
+            result->Complete(status == BlockProtocol::Status::Ok ? static_cast<ssize_t>(written) : -1);
+          }))
+    {
+      return result;
+    }
+#endif
+
+    bool rtn = this->Call("WriteBlock", args, std::move(body),
+      [result, latency, watch](Json::Value & response, bool error)
       {
+        latency->Record(watch.ElapsedMicros(), !error);
+
         if (error || !response.isInt())
         {
           result->Complete(-1);
@@ -55,7 +82,8 @@ namespace bdfs
         {
           result->Complete(static_cast<ssize_t>(response.asInt()));
         }
-      }
+      },
+      this->GetDeadline()
     );
 
     return rtn ? result : nullptr;
@@ -64,6 +92,11 @@ namespace bdfs
 
   AsyncResultPtr<std::string> BdPartition::Read(uint64_t blockId, uint32_t offset, uint32_t size)
   {
+    if (!this->health->Allow())
+    {
+      return nullptr;
+    }
+
     BdObject::CArgs args;
     args["block"] = Json::Value::UInt(blockId);
     args["offset"] = Json::Value::UInt(offset);
@@ -71,6 +104,18 @@ namespace bdfs
 
     auto result = std::make_shared<AsyncResult<std::string>>();
 
+#if !defined(_WIN32)
+    if (this->blockClient && this->blockClient->IsAvailable() &&
+        this->blockClient->ReadBlock(this->Name(), blockId, offset, size,
+          [result](BlockProtocol::Status status, uint32_t, std::string && data)
+          {
+            result->Complete(status == BlockProtocol::Status::Ok ? std::move(data) : std::string());
+          }))
+    {
+      return result;
+    }
+#endif
+
     bool rtn = this->Call("ReadBlock", args,
       [result, size](std::string && data, bool error)
       {
@@ -89,8 +134,359 @@ namespace bdfs
   }
 
 
+  AsyncResultPtr<ssize_t> BdPartition::Read(uint64_t blockId, uint32_t offset, ReceiveBufferPtr buffer, uint32_t size)
+  {
+    auto result = std::make_shared<AsyncResult<ssize_t>>();
+
+    bool rtn = this->Read(blockId, offset, std::move(buffer), size, false,
+      [result](ssize_t received)
+      {
+        result->Complete(received);
+      }
+    );
+
+    return rtn ? result : nullptr;
+  }
+
+
+  bool BdPartition::Read(uint64_t blockId, uint32_t offset, ReceiveBufferPtr buffer, uint32_t size, bool httpOnly, ReadCallback callback)
+  {
+    if (!buffer || buffer->Capacity() < size || !this->health->Allow())
+    {
+      return false;
+    }
+
+    BdObject::CArgs args;
+    args["block"] = Json::Value::UInt(blockId);
+    args["offset"] = Json::Value::UInt(offset);
+    args["size"] = Json::Value::UInt(size);
+
+    auto latency = this->latency;
+    StopWatch watch;
+
+#if !defined(_WIN32)
+    if (!httpOnly && this->blockClient && this->blockClient->IsAvailable() &&
+        this->blockClient->ReadBlock(this->Name(), blockId, offset, buffer, size,
+          [callback, size, latency, watch](BlockProtocol::Status status, uint32_t received, std::string &&)
+          {
+            latency->Record(watch.ElapsedMicros(), status == BlockProtocol::Status::Ok);
+            callback(status == BlockProtocol::Status::Ok && received == size ? static_cast<ssize_t>(received) : -1);
+          }))
+    {
+      return true;
+    }
+#endif
+
+    return this->Call("ReadBlock", args, buffer,
+      [callback, size, latency, watch](size_t received, bool error)
+      {
+        latency->Record(watch.ElapsedMicros(), !error);
+        callback(!error && received == size ? static_cast<ssize_t>(received) : -1);
+      },
+      this->GetDeadline()
+    );
+  }
+
+
+  static Json::Value encodeextents(const std::vector<BlockExtent> & extents)
+  {
+    Json::Value result(Json::arrayValue);
+
+    for (const auto & extent : extents)
+    {
+      Json::Value entry(Json::arrayValue);
+      entry.append(Json::Value::UInt(extent.block));
+      entry.append(Json::Value::UInt(extent.offset));
+      entry.append(Json::Value::UInt(extent.size));
+      result.append(entry);
+    }
+
+    return result;
+  }
+
+
+#if !defined(_WIN32)
+  // Tracks extents sent as individual requests on the binary path. One extra
+  // count is held until all of them are sent, so completion cannot race the sender.
+  struct BatchState
+  {
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed{false};
+    std::string data;
+
+    explicit BatchState(size_t count) : remaining(count + 1) {}
+  };
+#endif
+
+
+  AsyncResultPtr<ssize_t> BdPartition::WriteBlocks(const std::vector<BlockExtent> & extents, SendBufferPtr body)
+  {
+    size_t total = 0;
+    for (const auto & extent : extents)
+    {
+      total += extent.size;
+    }
+
+    if (extents.empty() || !body || body->Size() != total || !this->health->Allow())
+    {
+      return nullptr;
+    }
+
+    if (extents.size() == 1)
+    {
+      return this->Write(extents[0].block, extents[0].offset, std::move(body));
+    }
+
+    auto result = std::make_shared<AsyncResult<ssize_t>>();
+
+#if !defined(_WIN32)
+    if (this->blockClient && this->blockClient->IsAvailable())
+    {
+      // Pipelined on one connection, so a batch only saves the per request framing
+      auto state = std::make_shared<BatchState>(extents.size());
+
+      auto finish = [result, state, total]()
+      {
+        if (--state->remaining == 0)
+        {
+          result->Complete(state->failed ? static_cast<ssize_t>(-1) : static_cast<ssize_t>(total));
+        }
+      };
+
+      size_t position = 0;
+      for (size_t i = 0; i < extents.size(); ++i)
+      {
+        const auto & extent = extents[i];
+
+        bool sent = this->blockClient->WriteBlock(this->Name(), extent.block, extent.offset, *body, position, extent.size,
+          [state, finish, extent](BlockProtocol::Status status, uint32_t written, std::string &&)
+          {
+            if (status != BlockProtocol::Status::Ok || written != extent.size)
+            {
+              state->failed = true;
+            }
+
+            finish();
+          });
+
+        if (!sent && i == 0)
+        {
+          // Nothing went out, use HTTP instead
+          break;
+        }
+
+        if (!sent)
+        {
+          state->failed = true;
+          finish();
+        }
+
+        position += extent.size;
+
+        if (i == extents.size() - 1)
+        {
+          finish();
+          return result;
+        }
+      }
+    }
+#endif
+
+    BdObject::CArgs args;
+    args["extents"] = encodeextents(extents);
+
+    bool rtn = this->Call("WriteBlocks", args, std::move(body),
+      [result](Json::Value & response, bool error)
+      {
+        if (error || !response.isIntegral())
+        {
+          result->Complete(-1);
+        }
+        else
+        {
+          result->Complete(static_cast<ssize_t>(response.asUInt()));
+        }
+      }
+    );
+
+    return rtn ? result : nullptr;
+  }
+
+
+  AsyncResultPtr<std::string> BdPartition::ReadBlocks(const std::vector<BlockExtent> & extents)
+  {
+    if (extents.empty() || !this->health->Allow())
+    {
+      return nullptr;
+    }
+
+    if (extents.size() == 1)
+    {
+      return this->Read(extents[0].block, extents[0].offset, extents[0].size);
+    }
+
+    size_t total = 0;
+    for (const auto & extent : extents)
+    {
+      total += extent.size;
+    }
+
+    auto result = std::make_shared<AsyncResult<std::string>>();
+
+#if !defined(_WIN32)
+    if (this->blockClient && this->blockClient->IsAvailable())
+    {
+      auto state = std::make_shared<BatchState>(extents.size());
+      state->data.resize(total);
+
+      auto finish = [result, state]()
+      {
+        if (--state->remaining == 0)
+        {
+          result->Complete(state->failed ? std::string() : std::move(state->data));
+        }
+      };
+
+      size_t position = 0;
+      for (size_t i = 0; i < extents.size(); ++i)
+      {
+        const auto & extent = extents[i];
+
+        bool sent = this->blockClient->ReadBlock(this->Name(), extent.block, extent.offset, extent.size,
+          [state, finish, extent, position](BlockProtocol::Status status, uint32_t, std::string && data)
+          {
+            if (status != BlockProtocol::Status::Ok || data.size() != extent.size)
+            {
+              state->failed = true;
+            }
+            else
+            {
+              memcpy(&state->data[position], data.data(), data.size());
+            }
+
+            finish();
+          });
+
+        if (!sent && i == 0)
+        {
+          break;
+        }
+
+        if (!sent)
+        {
+          state->failed = true;
+          finish();
+        }
+
+        position += extent.size;
+
+        if (i == extents.size() - 1)
+        {
+          finish();
+          return result;
+        }
+      }
+    }
+#endif
+
+    BdObject::CArgs args;
+    args["extents"] = encodeextents(extents);
+
+    bool rtn = this->Call("ReadBlocks", args,
+      [result, total](std::string && data, bool error)
+      {
+        if (error || data.size() != total)
+        {
+          result->Complete(std::string());
+        }
+        else
+        {
+          result->Complete(std::move(data));
+        }
+      }
+    );
+
+    return rtn ? result : nullptr;
+  }
+
+
+  AsyncResultPtr<bool> BdPartition::Verify(uint64_t blockId)
+  {
+    if (!this->health->Allow())
+    {
+      return nullptr;
+    }
+
+    BdObject::CArgs args;
+    args["block"] = Json::Value::UInt(blockId);
+
+    auto result = std::make_shared<AsyncResult<bool>>();
+
+#if !defined(_WIN32)
+    if (this->blockClient && this->blockClient->IsAvailable() &&
+        this->blockClient->VerifyBlock(this->Name(), blockId,
+          [result](BlockProtocol::Status status, uint32_t, std::string &&)
+          {
+            result->Complete(status == BlockProtocol::Status::Ok);
+          }))
+    {
+      return result;
+    }
+#endif
+
+    bool rtn = this->Call("VerifyBlock", args,
+      [result](Json::Value & response, bool error)
+      {
+        result->Complete(!error && response.isBool() && response.asBool());
+      }
+    );
+
+    return rtn ? result : nullptr;
+  }
+
+
+  AsyncResultPtr<bool> BdPartition::Discard(uint64_t blockId)
+  {
+    if (!this->health->Allow())
+    {
+      return nullptr;
+    }
+
+    BdObject::CArgs args;
+    args["block"] = Json::Value::UInt(blockId);
+
+    auto result = std::make_shared<AsyncResult<bool>>();
+
+#if !defined(_WIN32)
+    if (this->blockClient && this->blockClient->IsAvailable() &&
+        this->blockClient->DiscardBlock(this->Name(), blockId,
+          [result](BlockProtocol::Status status, uint32_t, std::string &&)
+          {
+            result->Complete(status == BlockProtocol::Status::Ok);
+          }))
+    {
+      return result;
+    }
+#endif
+
+    bool rtn = this->Call("DiscardBlock", args,
+      [result](Json::Value & response, bool error)
+      {
+        result->Complete(!error && response.isBool() && response.asBool());
+      }
+    );
+
+    return rtn ? result : nullptr;
+  }
+
+
   AsyncResultPtr<bool> BdPartition::Delete()
   {
+    if (!this->health->Allow())
+    {
+      return nullptr;
+    }
+
     BdObject::CArgs args;
 
     auto result = std::make_shared<AsyncResult<bool>>();
@@ -26,8 +26,14 @@
 #include <stdlib.h>
 #include <memory>
 #include <string>
+#include <vector>
 #include "BdObject.h"
 #include "AsyncResult.h"
+#include "LatencyTracker.h"
+#include "HostHealth.h"
+#if !defined(_WIN32)
+#include "BlockClient.h"
+#endif
 
 #ifdef _WIN32
 #include <basetsd.h>
@@ -36,16 +42,74 @@ typedef SSIZE_T ssize_t;
 
 namespace bdfs
 {
+  // A byte range within one block of a partition
+  struct BlockExtent
+  {
+    uint64_t block;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+
   class BdPartition : public BdObject
   {
   public:
 
     BdPartition(const char * base, const char * name, const char * path, const char * type);
 
-    AsyncResultPtr<ssize_t> Write(uint64_t blockId, uint32_t offset, const void * data, uint32_t size);
+    // The data is streamed from the body, which must stay alive until the
+    // result completes or be detached by a caller that stops waiting
+    AsyncResultPtr<ssize_t> Write(uint64_t blockId, uint32_t offset, SendBufferPtr body);
 
     AsyncResultPtr<std::string> Read(uint64_t blockId, uint32_t offset, uint32_t size);
 
+    // Reads into the caller's buffer without intermediate copies. The result is
+    // the number of bytes read, or -1 on failure including a short read. A
+    // caller that stops waiting must Detach the buffer before freeing it.
+    AsyncResultPtr<ssize_t> Read(uint64_t blockId, uint32_t offset, ReceiveBufferPtr buffer, uint32_t size);
+
+    // Callback form of the above. With httpOnly the binary data port is
+    // skipped, which gives a hedge a different path than the first attempt.
+    using ReadCallback = std::function<void(ssize_t)>;
+    bool Read(uint64_t blockId, uint32_t offset, ReceiveBufferPtr buffer, uint32_t size, bool httpOnly, ReadCallback callback);
+
+    // Milliseconds after which a block read should be hedged, 0 if it should not
+    uint32_t GetHedgeDelay() const    { return this->latency->GetHedgeDelay(); }
+
+    // Writes several extents in one request, the body holds their contents
+    // back to back. The result is the total number of bytes written or -1.
+    AsyncResultPtr<ssize_t> WriteBlocks(const std::vector<BlockExtent> & extents, SendBufferPtr body);
+
+    // Reads several extents in one request, the result holds their contents
+    // back to back or is empty on failure
+    AsyncResultPtr<std::string> ReadBlocks(const std::vector<BlockExtent> & extents);
+
+    // True if the block is present and intact on the host. Like every request
+    // here it returns null at once while the host's circuit is open.
+    AsyncResultPtr<bool> Verify(uint64_t blockId);
+
+    // Lets the host drop the block, it reads back as zeros afterwards
+    AsyncResultPtr<bool> Discard(uint64_t blockId);
+
     AsyncResultPtr<bool> Delete();
+
+#if !defined(_WIN32)
+    // Block operations go over the binary data port of the host while it is
+    // reachable, and over HTTP otherwise
+    void SetBlockClient(std::shared_ptr<BlockClient> client)  { this->blockClient = std::move(client); }
+#endif
+
+  private:
+
+    // Single block reads and writes feed the latency of the host, which
+    // determines their deadlines
+    std::shared_ptr<LatencyTracker> latency;
+
+    // Block requests fail at once while the circuit of the host is open
+    std::shared_ptr<HostHealth> health;
+
+#if !defined(_WIN32)
+    std::shared_ptr<BlockClient> blockClient;
+#endif
   };
 }
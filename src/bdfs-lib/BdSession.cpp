@@ -24,31 +24,14 @@
 #include "HttpRequest.h"
 #include "BdObject.h"
 #include "BdTypes.h"
-#include "AsyncQueue.h"
+#include "HttpDispatcher.h"
+#include "HostHealth.h"
+#include "PathRacer.h"
 
 #include <sstream>
 
 namespace bdfs
 {
-  namespace
-  {
-    void OnDequeue(HttpRequest* & request, void * context)
-    {
-#ifdef DEBUG_API
-      printf("Processing: %s\n", request->Url().c_str());
-#endif
-      request->Execute();
-    }
-
-    void OnDelete(HttpRequest* & request, void * context)
-    {
-      delete (request);
-    }
-
-    AsyncQueue<HttpRequest*> queue(OnDequeue, OnDelete, NULL);
-    static bool queueStarted = false;
-  }
-
   SharedMutex BdSession::mutex;
   HttpConfig BdSession::defaultConfig;
   std::map<std::string, std::shared_ptr<BdSession> > BdSession::sessions;
@@ -68,11 +51,9 @@ namespace bdfs
   std::shared_ptr<BdSession> BdSession::CreateSession(const char * base, HttpConfig * config, bool ownConfig)
   {
     WriteLock _(mutex);
-    if (!queueStarted)
-    {
-      queue.Start();
-      queueStarted = true;
-    }
+    HttpDispatcher::Start();
+    HostHealth::Start();
+    PathRacer::Start();
     if (config == NULL)
     {
       ownConfig = false;
@@ -81,18 +62,39 @@ namespace bdfs
 
     auto session = std::shared_ptr<BdSession>(new BdSession(base, config, ownConfig));
     sessions[session->Base()] = session;
+
+    // Any answer from the host shows that it is reachable again. The probe request keeps the
+    // session, and with it the config, alive until it completes.
+    std::weak_ptr<BdSession> weak = session;
+    HostHealth::Get(session->Base())->SetProbe([weak]()
+    {
+      auto session = weak.lock();
+      if (!session)
+      {
+        return;
+      }
+
+      HttpRequest * req = new HttpRequest((session->Base() + "/").c_str(), session->config);
+      req->Get([session](std::string &&, bool) {});
+      HttpDispatcher::Enqueue(session->Base(), req);
+    });
+
     return session;
   }
 
   BdSession::BdSession(const char * base, HttpConfig * config, bool ownConfig) :
     config(config),
     base(base),
-    ownConfig(ownConfig)
+    ownConfig(ownConfig),
+    latency(LatencyTracker::Get(this->base))
   {
+    PathRacer::Add(this->base, config);
   }
 
   BdSession::~BdSession()
   {
+    PathRacer::Remove(this->config);
+
     if (this->ownConfig && this->config)
     {
       delete this->config;
@@ -102,11 +104,9 @@ namespace bdfs
 
   void BdSession::Stop()
   {
-    if (queueStarted)
-    {
-      queue.Stop();
-      queueStarted = false;
-    }
+    PathRacer::Stop();
+    HostHealth::Stop();
+    HttpDispatcher::Stop();
   }
 
   std::string BdSession::__EncodeArgs(BdObject::CArgs & args)
@@ -156,7 +156,7 @@ namespace bdfs
     }
     
     req->Post(data, callback);
-    queue.Enqueue(req);
+    HttpDispatcher::Enqueue(this->base, req);
     return true;
   }
 
@@ -171,7 +171,23 @@ namespace bdfs
     }
     
     req->Post(data, callback);
-    queue.Enqueue(req);
+    HttpDispatcher::Enqueue(this->base, req);
+    return true;
+  }
+
+
+  bool BdSession::Call(std::string & path, const char * method, BdObject::CArgs & args, ReceiveBufferPtr buffer, BdObject::BufferCallback callback, uint32_t timeout)
+  {
+    Json::Value data;
+    auto req = CreateRequest(path, method, args, data);
+    if (!req)
+    {
+      return false;
+    }
+    
+    req->SetTimeout(timeout);
+    req->Post(data, std::move(buffer), callback);
+    HttpDispatcher::Enqueue(this->base, req);
     return true;
   }
 
@@ -194,8 +210,36 @@ namespace bdfs
     if (req != NULL)
     {
       req->Post("application/octet-stream", body, bodyLen, callback);
-      queue.Enqueue(req);
+      HttpDispatcher::Enqueue(this->base, req);
+    }
+    return true;
+  }
+
+
+  bool BdSession::Call(std::string & path, const char * method, BdObject::CArgs & args, SendBufferPtr body, BdObject::Callback callback, uint32_t timeout)
+  {
+    // The request would never get a completion callback without a body
+    if (!body || body->Size() == 0)
+    {
+      return false;
     }
+
+    std::string pathCopy = path;
+    std::stringstream ss;
+    ss << base;
+    ss << "/api/";
+    std::size_t css = path.find("://");
+    if (css == std::string::npos) { return false; }
+    ss << pathCopy.replace(css, 2, "", 0);
+    ss << '/';
+    ss << method;
+    ss << this->__EncodeArgs(args);
+    std::string url = ss.str();
+
+    HttpRequest * req = new HttpRequest(url.c_str(), config);
+    req->SetTimeout(timeout);
+    req->Post("application/octet-stream", std::move(body), callback);
+    HttpDispatcher::Enqueue(this->base, req);
     return true;
   }
 
@@ -213,6 +257,35 @@ namespace bdfs
       return 1;
     }
 
-    return 1000 * (this->config->ConnectTimeout() + this->config->RequestTimeout()) * (1 + this->config->Relays().size());
+    return 1000 * (this->config->ConnectTimeout() + this->config->RequestTimeout()) * this->GetAttempts();
+  }
+
+
+  uint32_t BdSession::GetAttempts() const
+  {
+    // A request that cannot connect is retried once over a newly raced path
+    return this->config->Relays().empty() ? 1 : 2;
+  }
+
+
+  uint32_t BdSession::GetDeadline() const
+  {
+    if (!this->config)
+    {
+      return 1;
+    }
+
+    return this->latency->GetDeadline(1000 * (this->config->ConnectTimeout() + this->config->RequestTimeout()));
+  }
+
+
+  uint32_t BdSession::GetBlockTimeout() const
+  {
+    if (!this->config)
+    {
+      return 1;
+    }
+
+    return this->GetDeadline() * this->GetAttempts();
   }
 }
@@ -24,6 +24,7 @@
 
 #include "HttpConfig.h"
 #include "BdObject.h"
+#include "LatencyTracker.h"
 #include <string.h>
 #include <json/json.h>
 
@@ -38,6 +39,7 @@ namespace bdfs
     std::string base;
     std::string st;
     bool ownConfig;
+    std::shared_ptr<LatencyTracker> latency;
 
     std::string __EncodeArgs(BdObject::CArgs & args);
 
@@ -62,9 +64,24 @@ namespace bdfs
     bool Call(std::string & path, const char * method, BdObject::CArgs & args, BdObject::Callback callback);
     bool Call(std::string & path, const char * method, BdObject::CArgs & args, BdObject::RawCallback callback);
     bool Call(std::string & path, const char * method, BdObject::CArgs & args, const void * body, size_t bodyLen, BdObject::Callback callback);
+    // A non zero timeout is the deadline of each attempt in milliseconds
+    bool Call(std::string & path, const char * method, BdObject::CArgs & args, ReceiveBufferPtr buffer, BdObject::BufferCallback callback, uint32_t timeout = 0);
+    bool Call(std::string & path, const char * method, BdObject::CArgs & args, SendBufferPtr body, BdObject::Callback callback, uint32_t timeout = 0);
 
     std::shared_ptr<BdObject> CreateObject(const char * name, const char * path, const char * type);
 
+    // Worst case for a request including its retry over another path, from the configuration
     uint32_t GetTimeout() const;
+
+    // Deadline of one attempt of a block request, derived from the observed latency
+    uint32_t GetDeadline() const;
+
+    // How long to wait for a block request including its retry over another path
+    uint32_t GetBlockTimeout() const;
+
+    // Attempts a request may make, see HttpRequest::Continue
+    uint32_t GetAttempts() const;
+
+    LatencyTracker & Latency() { return *latency; }
   };
 }
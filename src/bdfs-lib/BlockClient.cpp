@@ -0,0 +1,470 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "BlockClient.h"
+
+namespace bdfs
+{
+  std::mutex BlockClient::clientsMutex;
+  std::map<std::string, std::weak_ptr<BlockClient>> BlockClient::clients;
+
+
+  static std::string hostfromurl(const std::string & url)
+  {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of(":/?#", start);
+
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+  }
+
+
+  BlockClient::Connection::~Connection()
+  {
+    if (this->fd >= 0)
+    {
+      shutdown(this->fd, SHUT_RDWR);
+    }
+
+    if (this->receiver.joinable())
+    {
+      this->receiver.join();
+    }
+
+    if (this->fd >= 0)
+    {
+      close(this->fd);
+    }
+  }
+
+
+  std::shared_ptr<BlockClient> BlockClient::Get(const std::string & url, uint16_t port)
+  {
+    std::string host = hostfromurl(url);
+    std::string key = host + ":" + std::to_string(port);
+
+    std::unique_lock<std::mutex> lock(clientsMutex);
+
+    auto client = clients[key].lock();
+    if (!client)
+    {
+      client.reset(new BlockClient(host, port));
+      clients[key] = client;
+    }
+
+    return client;
+  }
+
+
+  BlockClient::BlockClient(std::string host, uint16_t port)
+    : host(std::move(host))
+    , port(port)
+  {
+  }
+
+
+  BlockClient::~BlockClient()
+  {
+    std::unique_lock<std::mutex> sendLock(this->sendMutex);
+
+    if (this->connection)
+    {
+      this->Fail(this->connection.get());
+      this->connection.reset();
+    }
+  }
+
+
+  bool BlockClient::IsAvailable() const
+  {
+    return time(nullptr) >= this->retryAt.load();
+  }
+
+
+  bool BlockClient::ReadBlock(const std::string & partition, uint64_t block, uint32_t offset, uint32_t size, Callback callback)
+  {
+    return this->Send(BlockProtocol::Op::ReadBlock, partition, block, offset, size, nullptr, 0, std::move(callback));
+  }
+
+
+  bool BlockClient::ReadBlock(const std::string & partition, uint64_t block, uint32_t offset, ReceiveBufferPtr buffer, uint32_t size, Callback callback)
+  {
+    return this->Send(BlockProtocol::Op::ReadBlock, partition, block, offset, size, nullptr, 0, std::move(callback), std::move(buffer));
+  }
+
+
+  bool BlockClient::WriteBlock(const std::string & partition, uint64_t block, uint32_t offset, const SendBuffer & body, size_t position, uint32_t size, Callback callback)
+  {
+    return this->Send(BlockProtocol::Op::WriteBlock, partition, block, offset, size, &body, position, std::move(callback));
+  }
+
+
+  bool BlockClient::VerifyBlock(const std::string & partition, uint64_t block, Callback callback)
+  {
+    return this->Send(BlockProtocol::Op::VerifyBlock, partition, block, 0, 0, nullptr, 0, std::move(callback));
+  }
+
+
+  bool BlockClient::DiscardBlock(const std::string & partition, uint64_t block, Callback callback)
+  {
+    return this->Send(BlockProtocol::Op::DiscardBlock, partition, block, 0, 0, nullptr, 0, std::move(callback));
+  }
+
+
+  bool BlockClient::Send(BlockProtocol::Op op, const std::string & partition, uint64_t block, uint32_t offset, uint32_t size,
+                         const SendBuffer * body, size_t position, Callback callback, ReceiveBufferPtr target)
+  {
+    if (partition.empty() || partition.size() > UINT8_MAX || size > BlockProtocol::MAX_PAYLOAD)
+    {
+      return false;
+    }
+
+    std::shared_ptr<Connection> conn = this->Acquire();
+    if (!conn)
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> sendLock(this->sendMutex);
+
+    uint32_t id = 0;
+
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (conn->broken)
+      {
+        return false;
+      }
+
+      id = ++this->nextId;
+      this->pending[id] = Request{op, std::move(callback), std::move(target)};
+    }
+
+    BlockProtocol::RequestHeader header;
+    header.magic = BlockProtocol::MAGIC;
+    header.id = id;
+    header.op = op;
+    header.nameLength = static_cast<uint8_t>(partition.size());
+    header.block = block;
+    header.offset = offset;
+    header.size = size;
+
+    uint8_t frame[BlockProtocol::REQUEST_HEADER_SIZE + UINT8_MAX];
+    BlockProtocol::Encode(header, frame);
+    memcpy(frame + BlockProtocol::REQUEST_HEADER_SIZE, partition.c_str(), partition.size());
+
+    bool sent = BlockProtocol::SendAll(conn->fd, frame, BlockProtocol::REQUEST_HEADER_SIZE + partition.size());
+    if (sent && op == BlockProtocol::Op::WriteBlock)
+    {
+      sent = body->Visit(position, size, [&conn](const uint8_t * data, size_t len)
+      {
+        return BlockProtocol::SendAll(conn->fd, data, len);
+      });
+    }
+
+    if (!sent)
+    {
+      bool owned = false;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+
+        auto itr = this->pending.find(id);
+        if (itr != this->pending.end())
+        {
+          this->pending.erase(itr);
+          owned = true;
+        }
+      }
+
+      this->Fail(conn.get());
+
+      // If the receiver got to the request first it has completed it already
+      return !owned;
+    }
+
+    return true;
+  }
+
+
+  std::shared_ptr<BlockClient::Connection> BlockClient::Acquire()
+  {
+    std::shared_ptr<Connection> old;
+
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (this->connection && !this->connection->broken)
+      {
+        return this->connection;
+      }
+
+      // Requests made while another thread connects go over http instead of waiting for it
+      if (this->connecting || !this->IsAvailable())
+      {
+        return nullptr;
+      }
+
+      this->connecting = true;
+      old = std::move(this->connection);
+    }
+
+    // The old receiver has failed its requests already, wait for it to exit
+    old.reset();
+
+    auto conn = this->Connect();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->connecting = false;
+
+    if (!conn)
+    {
+      this->retryAt = time(nullptr) + RETRY_INTERVAL;
+      return nullptr;
+    }
+
+    this->connection = conn;
+    return conn;
+  }
+
+
+  std::shared_ptr<BlockClient::Connection> BlockClient::Connect()
+  {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo * addrs = nullptr;
+    if (getaddrinfo(this->host.c_str(), std::to_string(this->port).c_str(), &hints, &addrs) != 0)
+    {
+      return nullptr;
+    }
+
+    int fd = -1;
+
+    for (auto addr = addrs; addr != nullptr && fd < 0; addr = addr->ai_next)
+    {
+      fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+      if (fd < 0)
+      {
+        continue;
+      }
+
+      // Connect without blocking so that an unreachable host costs at most the timeout
+      int flags = fcntl(fd, F_GETFL, 0);
+      fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+      bool connected = connect(fd, addr->ai_addr, addr->ai_addrlen) == 0;
+      if (!connected && errno == EINPROGRESS)
+      {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        connected = poll(&pfd, 1, CONNECT_TIMEOUT * 1000) == 1 &&
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 &&
+                    error == 0;
+      }
+
+      if (!connected)
+      {
+        close(fd);
+        fd = -1;
+        continue;
+      }
+
+      fcntl(fd, F_SETFL, flags);
+    }
+
+    freeaddrinfo(addrs);
+
+    if (fd < 0)
+    {
+      printf("Block protocol: failed to connect to %s:%u, using http.\n", this->host.c_str(), this->port);
+      return nullptr;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    // A host that stalls in the middle of a frame breaks the connection instead of blocking forever
+    struct timeval timeout = { IO_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    auto conn = std::make_shared<Connection>();
+    conn->fd = fd;
+    conn->receiver = std::thread(&BlockClient::ReceiveProc, this, conn.get());
+
+    return conn;
+  }
+
+
+  void BlockClient::ReceiveProc(Connection * connection)
+  {
+    uint8_t buf[BlockProtocol::RESPONSE_HEADER_SIZE];
+
+    std::vector<uint8_t> scratch(RECV_CHUNK);
+
+    while (true)
+    {
+      // The connection may stay idle for any time, the receive timeout only applies once a response has started
+      struct pollfd pfd = { connection->fd, POLLIN, 0 };
+      int ready = poll(&pfd, 1, -1);
+      if (ready < 0 && errno == EINTR)
+      {
+        continue;
+      }
+
+      if (ready <= 0 || !BlockProtocol::RecvAll(connection->fd, buf, sizeof(buf)))
+      {
+        break;
+      }
+
+      BlockProtocol::ResponseHeader header;
+      BlockProtocol::Decode(buf, header);
+
+      if (header.magic != BlockProtocol::MAGIC)
+      {
+        break;
+      }
+
+      Request request;
+
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+
+        auto itr = this->pending.find(header.id);
+        if (itr == this->pending.end())
+        {
+          // Without the request the payload cannot be skipped reliably
+          break;
+        }
+
+        request = std::move(itr->second);
+        this->pending.erase(itr);
+      }
+
+      std::string data;
+      if (request.op == BlockProtocol::Op::ReadBlock && header.status == BlockProtocol::Status::Ok)
+      {
+        if (header.size > BlockProtocol::MAX_PAYLOAD)
+        {
+          request.callback(BlockProtocol::Status::Failed, 0, std::string());
+          break;
+        }
+
+        if (request.target)
+        {
+          // The payload is received into the scratch buffer and copied under the buffer lock one chunk at a
+          // time, so a caller that detaches never waits on the socket. If it gave up, or the buffer is too
+          // small, the rest of the payload is still consumed.
+          bool received = true;
+          bool stored = true;
+
+          for (size_t left = header.size; left > 0 && received; )
+          {
+            size_t len = std::min(left, scratch.size());
+            received = BlockProtocol::RecvAll(connection->fd, scratch.data(), len);
+            stored = stored && received && request.target->Write(scratch.data(), len);
+            left -= len;
+          }
+
+          if (!received)
+          {
+            request.callback(BlockProtocol::Status::Failed, 0, std::string());
+            break;
+          }
+
+          if (stored)
+          {
+            request.callback(header.status, header.size, std::string());
+          }
+          else
+          {
+            request.callback(BlockProtocol::Status::Failed, header.size, std::string());
+          }
+
+          continue;
+        }
+
+        data.resize(header.size);
+        if (header.size > 0 && !BlockProtocol::RecvAll(connection->fd, &data[0], header.size))
+        {
+          request.callback(BlockProtocol::Status::Failed, 0, std::string());
+          break;
+        }
+      }
+
+      request.callback(header.status, header.size, std::move(data));
+    }
+
+    this->Fail(connection);
+  }
+
+
+  void BlockClient::Fail(Connection * connection)
+  {
+    std::map<uint32_t, Request> failed;
+
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (connection->broken)
+      {
+        return;
+      }
+
+      connection->broken = true;
+      shutdown(connection->fd, SHUT_RDWR);
+
+      failed.swap(this->pending);
+    }
+
+    for (auto & entry : failed)
+    {
+      entry.second.callback(BlockProtocol::Status::Failed, 0, std::string());
+    }
+  }
+}
@@ -0,0 +1,149 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "BlockProtocol.h"
+#include "ReceiveBuffer.h"
+#include "SendBuffer.h"
+
+namespace bdfs
+{
+  // Client side of the binary block protocol. One instance, and one TCP
+  // connection, is shared by all partitions on a host. Requests are written
+  // as they come and the receiver thread completes them by id in whatever
+  // order the host answers.
+  class BlockClient
+  {
+  public:
+
+    // Receives the status, the size field of the response and, for ReadBlock, the data
+    using Callback = std::function<void(BlockProtocol::Status, uint32_t, std::string &&)>;
+
+  private:
+
+    struct Connection
+    {
+      int fd = -1;
+      std::atomic<bool> broken{false};
+      std::thread receiver;
+
+      ~Connection();
+    };
+
+    struct Request
+    {
+      BlockProtocol::Op op;
+      Callback callback;
+      ReceiveBufferPtr target;
+    };
+
+    // Seconds to stay on HTTP after the data port could not be reached
+    static const time_t RETRY_INTERVAL = 30;
+
+    static const int CONNECT_TIMEOUT = 5;
+
+    // Seconds a started frame may take to send or receive before the connection is dropped
+    static const int IO_TIMEOUT = 30;
+
+    // Bytes of a payload received at a time before they are copied to the caller's buffer
+    static const size_t RECV_CHUNK = 64 * 1024;
+
+  public:
+
+    // Returns the client for the host of the given url, creating it on first use
+    static std::shared_ptr<BlockClient> Get(const std::string & url, uint16_t port);
+
+    ~BlockClient();
+
+    // False while the data port is known to be unreachable, callers use HTTP then
+    bool IsAvailable() const;
+
+    // The requests return false if they could not be sent, in which case the
+    // callback is never invoked. Otherwise it is invoked exactly once, with
+    // Failed if the connection is lost before the response arrived.
+    bool ReadBlock(const std::string & partition, uint64_t block, uint32_t offset, uint32_t size, Callback callback);
+
+    // Receives the data straight into the buffer, the callback gets no data then
+    bool ReadBlock(const std::string & partition, uint64_t block, uint32_t offset, ReceiveBufferPtr buffer, uint32_t size, Callback callback);
+
+    // Sends size bytes of the body starting at position before returning
+    bool WriteBlock(const std::string & partition, uint64_t block, uint32_t offset, const SendBuffer & body, size_t position, uint32_t size, Callback callback);
+
+    bool VerifyBlock(const std::string & partition, uint64_t block, Callback callback);
+
+    bool DiscardBlock(const std::string & partition, uint64_t block, Callback callback);
+
+  private:
+
+    BlockClient(std::string host, uint16_t port);
+
+    bool Send(BlockProtocol::Op op, const std::string & partition, uint64_t block, uint32_t offset, uint32_t size,
+              const SendBuffer * body, size_t position, Callback callback, ReceiveBufferPtr target = nullptr);
+
+    // Returns the live connection, reconnecting if needed, or null if the caller should use http
+    std::shared_ptr<Connection> Acquire();
+
+    std::shared_ptr<Connection> Connect();
+
+    void ReceiveProc(Connection * connection);
+
+    void Fail(Connection * connection);
+
+  private:
+
+    std::string host;
+
+    uint16_t port;
+
+    // Serializes writes to the socket
+    std::mutex sendMutex;
+
+    // Guards the connection pointer and the pending requests
+    mutable std::mutex mutex;
+
+    std::shared_ptr<Connection> connection;
+
+    // Set while a thread connects outside of the locks
+    bool connecting = false;
+
+    std::map<uint32_t, Request> pending;
+
+    uint32_t nextId = 0;
+
+    std::atomic<time_t> retryAt{0};
+
+    static std::mutex clientsMutex;
+
+    static std::map<std::string, std::weak_ptr<BlockClient>> clients;
+  };
+}
@@ -0,0 +1,209 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace bdfs
+{
+  // Framing of the binary block protocol bdhost serves on its data port.
+  //
+  // A request is a fixed header followed by the partition name and, for
+  // WriteBlock, the data. A response is a fixed header followed by the data
+  // for ReadBlock. All integers are in network byte order. Responses carry
+  // the id of their request and may come back in any order, so a client can
+  // keep many requests in flight on one connection.
+  namespace BlockProtocol
+  {
+    static const uint32_t MAGIC = 0x42444250;  // "BDBP"
+
+    static const size_t REQUEST_HEADER_SIZE = 28;
+
+    static const size_t RESPONSE_HEADER_SIZE = 16;
+
+    // Upper bound for the data of a single frame
+    static const uint32_t MAX_PAYLOAD = 64 * 1024 * 1024;
+
+    enum class Op : uint8_t
+    {
+      ReadBlock = 1,
+      WriteBlock = 2,
+      VerifyBlock = 3,
+      DiscardBlock = 4
+    };
+
+    enum class Status : int32_t
+    {
+      Ok = 0,
+      NotFound = 1,
+      InvalidArguments = 2,
+      Failed = 3,
+      NotSupported = 4
+    };
+
+    struct RequestHeader
+    {
+      uint32_t magic;
+      uint32_t id;
+      Op op;
+      uint8_t nameLength;
+      uint64_t block;
+      uint32_t offset;
+      // Bytes to read for ReadBlock, bytes that follow the name for WriteBlock
+      uint32_t size;
+    };
+
+    struct ResponseHeader
+    {
+      uint32_t magic;
+      uint32_t id;
+      Status status;
+      // Bytes that follow for ReadBlock, bytes written for WriteBlock
+      uint32_t size;
+    };
+
+
+    inline void Put32(uint8_t * buf, uint32_t val)
+    {
+      buf[0] = static_cast<uint8_t>(val >> 24);
+      buf[1] = static_cast<uint8_t>(val >> 16);
+      buf[2] = static_cast<uint8_t>(val >> 8);
+      buf[3] = static_cast<uint8_t>(val);
+    }
+
+    inline uint32_t Get32(const uint8_t * buf)
+    {
+      return (static_cast<uint32_t>(buf[0]) << 24) |
+             (static_cast<uint32_t>(buf[1]) << 16) |
+             (static_cast<uint32_t>(buf[2]) << 8) |
+             static_cast<uint32_t>(buf[3]);
+    }
+
+    inline void Put64(uint8_t * buf, uint64_t val)
+    {
+      Put32(buf, static_cast<uint32_t>(val >> 32));
+      Put32(buf + 4, static_cast<uint32_t>(val));
+    }
+
+    inline uint64_t Get64(const uint8_t * buf)
+    {
+      return (static_cast<uint64_t>(Get32(buf)) << 32) | Get32(buf + 4);
+    }
+
+
+    inline bool SendAll(int fd, const void * buf, size_t len)
+    {
+      const uint8_t * ptr = static_cast<const uint8_t *>(buf);
+      while (len > 0)
+      {
+        ssize_t sent = send(fd, ptr, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+          continue;
+        }
+
+        if (sent <= 0)
+        {
+          return false;
+        }
+
+        ptr += sent;
+        len -= static_cast<size_t>(sent);
+      }
+
+      return true;
+    }
+
+    inline bool RecvAll(int fd, void * buf, size_t len)
+    {
+      uint8_t * ptr = static_cast<uint8_t *>(buf);
+      while (len > 0)
+      {
+        ssize_t received = recv(fd, ptr, len, 0);
+        if (received < 0 && errno == EINTR)
+        {
+          continue;
+        }
+
+        if (received <= 0)
+        {
+          return false;
+        }
+
+        ptr += received;
+        len -= static_cast<size_t>(received);
+      }
+
+      return true;
+    }
+
+
+    inline void Encode(const RequestHeader & header, uint8_t * buf)
+    {
+      Put32(buf, header.magic);
+      Put32(buf + 4, header.id);
+      buf[8] = static_cast<uint8_t>(header.op);
+      buf[9] = header.nameLength;
+      buf[10] = 0;
+      buf[11] = 0;
+      Put64(buf + 12, header.block);
+      Put32(buf + 20, header.offset);
+      Put32(buf + 24, header.size);
+    }
+
+    inline void Decode(const uint8_t * buf, RequestHeader & header)
+    {
+      header.magic = Get32(buf);
+      header.id = Get32(buf + 4);
+      header.op = static_cast<Op>(buf[8]);
+      header.nameLength = buf[9];
+      header.block = Get64(buf + 12);
+      header.offset = Get32(buf + 20);
+      header.size = Get32(buf + 24);
+    }
+
+    inline void Encode(const ResponseHeader & header, uint8_t * buf)
+    {
+      Put32(buf, header.magic);
+      Put32(buf + 4, header.id);
+      Put32(buf + 8, static_cast<uint32_t>(header.status));
+      Put32(buf + 12, header.size);
+    }
+
+    inline void Decode(const uint8_t * buf, ResponseHeader & header)
+    {
+      header.magic = Get32(buf);
+      header.id = Get32(buf + 4);
+      header.status = static_cast<Status>(Get32(buf + 8));
+      header.size = Get32(buf + 12);
+    }
+  }
+}
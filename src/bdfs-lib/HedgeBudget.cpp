@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <algorithm>
+#include "HedgeBudget.h"
+
+namespace bdfs
+{
+  std::mutex HedgeBudget::mutex;
+  uint32_t HedgeBudget::percent = HedgeBudget::DEFAULT_PERCENT;
+  uint32_t HedgeBudget::credits = 0;
+  Counter HedgeBudget::reads;
+  Counter HedgeBudget::hedges;
+  Counter HedgeBudget::wins;
+  Counter HedgeBudget::denied;
+
+
+  void HedgeBudget::Configure(uint32_t percent)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    HedgeBudget::percent = std::min<uint32_t>(percent, 100);
+    HedgeBudget::credits = 0;
+  }
+
+
+  void HedgeBudget::OnRead()
+  {
+    reads.Add();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    credits = std::min(credits + percent, BURST * 100);
+  }
+
+
+  bool HedgeBudget::TryAcquire()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      if (percent > 0 && credits >= 100)
+      {
+        credits -= 100;
+        hedges.Add();
+        return true;
+      }
+    }
+
+    denied.Add();
+    return false;
+  }
+
+
+  Json::Value HedgeBudget::GetStats()
+  {
+    Json::Value json;
+    json["counters"]["reads"] = Json::Value::UInt(reads.Get());
+    json["counters"]["hedges"] = Json::Value::UInt(hedges.Get());
+    json["counters"]["wins"] = Json::Value::UInt(wins.Get());
+    json["counters"]["denied"] = Json::Value::UInt(denied.Get());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    json["gauges"]["percent"] = Json::Value::UInt(percent);
+
+    return json;
+  }
+}
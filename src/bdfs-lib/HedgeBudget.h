@@ -0,0 +1,73 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <json/json.h>
+#include "Stats.h"
+
+namespace bdfs
+{
+  // Caps the extra requests sent to hedge slow block reads. Every read earns
+  // a fraction of a hedge, so over time at most the configured percentage of
+  // the reads is duplicated.
+  class HedgeBudget
+  {
+  public:
+
+    static const uint32_t DEFAULT_PERCENT = 5;
+
+    // A percentage of 0 disables hedging
+    static void Configure(uint32_t percent);
+
+    static void OnRead();
+
+    // Takes one hedge from the budget, false if it is exhausted
+    static bool TryAcquire();
+
+    static void OnWin()        { wins.Add(); }
+
+    static Json::Value GetStats();
+
+  private:
+
+    // Unused budget is kept for at most this many hedges
+    static const uint32_t BURST = 10;
+
+    static std::mutex mutex;
+
+    static uint32_t percent;
+
+    // In hundredths of a hedge
+    static uint32_t credits;
+
+    static Counter reads;
+
+    static Counter hedges;
+
+    static Counter wins;
+
+    static Counter denied;
+  };
+}
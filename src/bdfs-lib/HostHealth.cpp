@@ -0,0 +1,211 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "HostHealth.h"
+
+namespace bdfs
+{
+  std::mutex HostHealth::healthMutex;
+  std::map<std::string, std::shared_ptr<HostHealth>> HostHealth::hosts;
+  std::condition_variable HostHealth::cond;
+  std::thread HostHealth::prober;
+  bool HostHealth::running = false;
+
+
+  static std::string hostfromurl(const std::string & url)
+  {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of("/?#", start);
+
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+  }
+
+
+  std::shared_ptr<HostHealth> HostHealth::Get(const std::string & url)
+  {
+    std::string host = hostfromurl(url);
+
+    std::unique_lock<std::mutex> lock(healthMutex);
+
+    auto & health = hosts[host];
+    if (!health)
+    {
+      health = std::make_shared<HostHealth>();
+      health->name = host;
+    }
+
+    return health;
+  }
+
+
+  void HostHealth::Start()
+  {
+    std::unique_lock<std::mutex> lock(healthMutex);
+
+    if (running)
+    {
+      return;
+    }
+
+    running = true;
+    prober = std::thread(ProbeProc);
+  }
+
+
+  void HostHealth::Stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(healthMutex);
+
+      if (!running)
+      {
+        return;
+      }
+
+      running = false;
+    }
+
+    cond.notify_all();
+    prober.join();
+  }
+
+
+  Json::Value HostHealth::GetStats()
+  {
+    Json::Value json(Json::objectValue);
+
+    std::unique_lock<std::mutex> lock(healthMutex);
+
+    for (const auto & entry : hosts)
+    {
+      Json::Value & host = json["host " + entry.first];
+      host["counters"]["trips"] = Json::Value::UInt(entry.second->trips.Get());
+      host["counters"]["rejected"] = Json::Value::UInt(entry.second->rejected.Get());
+      host["gauges"]["state"] = Json::Value::UInt(static_cast<uint32_t>(entry.second->GetState()));
+    }
+
+    return json;
+  }
+
+
+  void HostHealth::SetProbe(Probe probe)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->probe = std::move(probe);
+  }
+
+
+  bool HostHealth::Allow()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->state == State::Open)
+    {
+      this->rejected.Add();
+      return false;
+    }
+
+    return true;
+  }
+
+
+  void HostHealth::OnSuccess()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->failures = 0;
+
+    if (this->state == State::Open)
+    {
+      this->state = State::HalfOpen;
+    }
+    else if (this->state == State::HalfOpen)
+    {
+      printf("Host %s recovered.\n", this->name.c_str());
+      this->state = State::Closed;
+    }
+  }
+
+
+  void HostHealth::OnFailure()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    ++this->failures;
+
+    if ((this->state == State::Closed && this->failures >= FAILURE_THRESHOLD) || this->state == State::HalfOpen)
+    {
+      printf("Host %s is unreachable, failing its requests until it recovers.\n", this->name.c_str());
+      this->state = State::Open;
+      this->trips.Add();
+    }
+  }
+
+
+  HostHealth::State HostHealth::GetState() const
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->state;
+  }
+
+
+  void HostHealth::ProbeProc()
+  {
+    std::unique_lock<std::mutex> lock(healthMutex);
+
+    while (running)
+    {
+      cond.wait_for(lock, std::chrono::milliseconds(PROBE_INTERVAL_MS));
+
+      if (!running)
+      {
+        break;
+      }
+
+      std::vector<Probe> probes;
+
+      for (const auto & entry : hosts)
+      {
+        std::unique_lock<std::mutex> hostLock(entry.second->mutex);
+
+        if (entry.second->state == State::Open && entry.second->probe)
+        {
+          probes.emplace_back(entry.second->probe);
+        }
+      }
+
+      lock.unlock();
+
+      for (const auto & probe : probes)
+      {
+        probe();
+      }
+
+      lock.lock();
+    }
+  }
+}
@@ -0,0 +1,115 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <json/json.h>
+#include "Stats.h"
+
+namespace bdfs
+{
+  // Circuit breaker of one host, shared by every session and partition in the
+  // process. After FAILURE_THRESHOLD transport failures in a row the circuit
+  // opens and block requests to the host fail at once. A background prober
+  // then checks the host periodically. The first probe that gets an answer
+  // half-opens the circuit, and the next real request closes it on success
+  // or opens it again on failure.
+  class HostHealth
+  {
+  public:
+
+    enum class State
+    {
+      Closed,
+      Open,
+      HalfOpen
+    };
+
+    // Issues a request to the host whose outcome is reported like any other
+    using Probe = std::function<void()>;
+
+    // Returns the health of the host of the given url, creating it on first use
+    static std::shared_ptr<HostHealth> Get(const std::string & url);
+
+    static void Start();
+
+    static void Stop();
+
+    // {"host <name>": {...}} for all hosts, in the layout of the other stats
+    static Json::Value GetStats();
+
+    void SetProbe(Probe probe);
+
+    // False while the circuit is open
+    bool Allow();
+
+    // Outcome of a request at the transport level, an error answer from the
+    // host still counts as a success
+    void OnSuccess();
+
+    void OnFailure();
+
+    State GetState() const;
+
+  private:
+
+    static const uint32_t FAILURE_THRESHOLD = 5;
+
+    static const uint32_t PROBE_INTERVAL_MS = 2000;
+
+    static void ProbeProc();
+
+  private:
+
+    mutable std::mutex mutex;
+
+    std::string name;
+
+    State state = State::Closed;
+
+    uint32_t failures = 0;
+
+    Probe probe;
+
+    Counter trips;
+
+    Counter rejected;
+
+    static std::mutex healthMutex;
+
+    static std::map<std::string, std::shared_ptr<HostHealth>> hosts;
+
+    static std::condition_variable cond;
+
+    static std::thread prober;
+
+    static bool running;
+  };
+}
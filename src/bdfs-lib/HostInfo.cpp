@@ -29,6 +29,17 @@ namespace bdfs
   {
     Json::Value result;
     result["url"] = this->url;
+
+    if (this->dataPort != 0)
+    {
+      result["dataPort"] = Json::UInt(this->dataPort);
+    }
+
+    if (this->direct)
+    {
+      result["direct"] = true;
+    }
+
     result["relays"] = Json::Value(Json::arrayValue);
 
     for (auto & relay : this->relays)
@@ -70,6 +81,13 @@ namespace bdfs
 
     this->url = obj["url"].asString();
 
+    if (obj["dataPort"].isIntegral())
+    {
+      this->dataPort = static_cast<uint16_t>(obj["dataPort"].asUInt());
+    }
+
+    this->direct = obj["direct"].isBool() && obj["direct"].asBool();
+
     if (!obj["relays"].isArray())
     {
       return true;
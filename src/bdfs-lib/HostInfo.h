@@ -42,6 +42,12 @@ namespace bdfs
 
     std::string url;
 
+    // Port of the binary block protocol on the same host as url, 0 if not served
+    uint16_t dataPort = 0;
+
+    // The host found url reachable from outside, relays are only a fallback
+    bool direct = false;
+
     std::vector<RelayInfo> relays;
   };
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <algorithm>
+#include "HostLimit.h"
+
+namespace bdfs
+{
+  size_t HostLimit::maximum = 32;
+  std::mutex HostLimit::limitMutex;
+  std::map<std::string, std::shared_ptr<HostLimit>> HostLimit::hosts;
+
+
+  static std::string hostfromurl(const std::string & url)
+  {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of("/?#", start);
+
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+  }
+
+
+  void HostLimit::Configure(size_t maximum)
+  {
+    std::unique_lock<std::mutex> lock(limitMutex);
+    HostLimit::maximum = std::max<size_t>(maximum, 1);
+  }
+
+
+  std::shared_ptr<HostLimit> HostLimit::Get(const std::string & url)
+  {
+    std::string host = hostfromurl(url);
+
+    std::unique_lock<std::mutex> lock(limitMutex);
+
+    auto & limit = hosts[host];
+    if (!limit)
+    {
+      limit = std::make_shared<HostLimit>();
+      limit->name = host;
+      limit->limit = std::min<double>(INITIAL_LIMIT, maximum);
+    }
+
+    return limit;
+  }
+
+
+  Json::Value HostLimit::GetStats()
+  {
+    Json::Value json(Json::objectValue);
+
+    std::unique_lock<std::mutex> lock(limitMutex);
+
+    for (const auto & entry : hosts)
+    {
+      Json::Value & host = json["host " + entry.first];
+      host["counters"]["limitIncreases"] = Json::Value::UInt(entry.second->increases.Get());
+      host["counters"]["limitCuts"] = Json::Value::UInt(entry.second->cuts.Get());
+      host["gauges"]["concurrencyLimit"] = Json::Value::UInt(entry.second->GetLimit());
+    }
+
+    return json;
+  }
+
+
+  size_t HostLimit::GetLimit() const
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return static_cast<size_t>(this->limit);
+  }
+
+
+  void HostLimit::OnComplete(uint64_t micros, bool success, size_t inflight)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    ++this->sinceCut;
+
+    if (!success)
+    {
+      this->Cut(ERROR_BACKOFF);
+      return;
+    }
+
+    this->smoothed = this->smoothed == 0 ? micros : this->smoothed + SMOOTHING * (micros - this->smoothed);
+
+    this->current = std::min(this->current, micros);
+    if (++this->samples == WINDOW_SAMPLES)
+    {
+      this->previous = this->current;
+      this->current = UINT64_MAX;
+      this->samples = 0;
+    }
+
+    uint64_t baseline = std::min(this->current, this->previous);
+    if (this->smoothed > baseline * TOLERANCE && this->smoothed > baseline + MIN_QUEUE_MICROS)
+    {
+      this->Cut(LATENCY_BACKOFF);
+      return;
+    }
+
+    // An unused limit says nothing about what the host can take
+    if (inflight + 1 >= static_cast<size_t>(this->limit) && this->limit < maximum)
+    {
+      this->limit = std::min<double>(this->limit + 1 / this->limit, maximum);
+      this->increases.Add();
+    }
+  }
+
+
+  void HostLimit::Cut(double factor)
+  {
+    // Requests sent before the last cut still see the old load
+    if (this->sinceCut < static_cast<uint64_t>(this->limit))
+    {
+      return;
+    }
+
+    this->limit = std::max(this->limit * factor, 1.0);
+    this->sinceCut = 0;
+    this->cuts.Add();
+
+    // The queue built up under the old limit drains, start over from the current latency
+    this->smoothed = 0;
+  }
+}
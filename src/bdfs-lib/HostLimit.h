@@ -0,0 +1,113 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <json/json.h>
+#include "Stats.h"
+
+namespace bdfs
+{
+  // Adaptive limit of the requests in flight to one host. Every request that
+  // completes while the limit is in use raises it by 1/limit, about one more
+  // request per round trip, as long as the smoothed latency stays close to
+  // the lowest latency seen recently. Once requests start queueing at the host
+  // and the latency jumps, or requests fail to reach it, the limit is cut
+  // multiplicatively. A cut takes effect before the next one is considered,
+  // so one burst of slow requests only counts once.
+  class HostLimit
+  {
+  public:
+
+    static const size_t INITIAL_LIMIT = 4;
+
+    // Upper bound of every host limit
+    static void Configure(size_t maximum);
+
+    // Returns the limit of the host of the given url, creating it on first use
+    static std::shared_ptr<HostLimit> Get(const std::string & url);
+
+    // {"host <name>": {...}} for all hosts, in the layout of the other stats
+    static Json::Value GetStats();
+
+    size_t GetLimit() const;
+
+    // A request that reached the host or failed to, with the number of
+    // requests to the host that were in flight when it completed
+    void OnComplete(uint64_t micros, bool success, size_t inflight);
+
+  private:
+
+    // Samples after which the oldest minimum latency is forgotten
+    static const uint32_t WINDOW_SAMPLES = 256;
+
+    // Latency above TOLERANCE times the minimum means requests are queueing
+    static const uint32_t TOLERANCE = 2;
+
+    // Queueing below this is noise on fast links
+    static const uint64_t MIN_QUEUE_MICROS = 5000;
+
+    static constexpr double LATENCY_BACKOFF = 0.75;
+
+    static constexpr double ERROR_BACKOFF = 0.5;
+
+    static constexpr double SMOOTHING = 0.1;
+
+    void Cut(double factor);
+
+  private:
+
+    mutable std::mutex mutex;
+
+    std::string name;
+
+    double limit = INITIAL_LIMIT;
+
+    double smoothed = 0;
+
+    // Minimum latency of the current and of the previous window
+    uint64_t current = UINT64_MAX;
+
+    uint64_t previous = UINT64_MAX;
+
+    uint32_t samples = 0;
+
+    // Completions since the last cut
+    uint64_t sinceCut = 0;
+
+    Counter increases;
+
+    Counter cuts;
+
+    static size_t maximum;
+
+    static std::mutex limitMutex;
+
+    static std::map<std::string, std::shared_ptr<HostLimit>> hosts;
+  };
+}
@@ -24,6 +24,7 @@
 
 #include "HttpCookies.h"
 #include "RelayInfo.h"
+#include "PathSet.h"
 #include <string>
 #include <vector>
 
@@ -31,6 +32,10 @@ namespace bdfs
 {
   class HttpConfig
   {
+  public:
+
+    using Path = PathSet::Path;
+
   private:
     HttpCookies cookies;
     uint32_t connectTimeout = 5;
@@ -41,8 +46,12 @@ namespace bdfs
     std::string caPath;
 
     std::vector<RelayInfo> relays;
-    int activeRelay = -1;
-    int activeRelayEndpoint = -1;
+
+    // The host reported its url reachable, relays are raced only when it fails
+    bool directHint = false;
+
+    // Requests to the host run concurrently and share the paths chosen last
+    PathSet paths;
 
   public:
     HttpCookies & Cookies() { return cookies; }
@@ -64,10 +73,10 @@ namespace bdfs
     void CaPath(const char * value) { caPath = value; }
 
     std::vector<RelayInfo> & Relays()         { return relays; }
-    int ActiveRelay()                         { return activeRelay; }
-    int ActiveRelayEndpoint()                 { return activeRelayEndpoint; }
     void Relays(std::vector<RelayInfo> val)   { relays = std::move(val); }
-    void ActiveRelay(int val)                 { activeRelay = val; }
-    void ActiveRelayEndpoint(int val)         { activeRelayEndpoint = val; }
+    bool DirectHint()                         { return directHint; }
+    void DirectHint(bool val)                 { directHint = val; }
+
+    PathSet & Paths()                         { return paths; }
   };
 }
@@ -0,0 +1,527 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include "HttpDispatcher.h"
+#include "HttpRequest.h"
+#include "HostHealth.h"
+
+#include <curl/curl.h>
+
+namespace bdfs
+{
+  namespace
+  {
+    CURLM * multi = nullptr;
+
+    // Share of the free slots of a host per priority class
+    const uint32_t weights[bdfs::PRIORITY_CLASSES] = { 8, 4, 2, 1 };
+
+    const char * classes[bdfs::PRIORITY_CLASSES] = { "Foreground", "Flush", "Prefetch", "Rebuild" };
+  }
+
+  std::mutex HttpDispatcher::mutex;
+  std::condition_variable HttpDispatcher::cond;
+  std::map<std::string, HttpDispatcher::Host> HttpDispatcher::hosts;
+  std::string HttpDispatcher::cursor;
+  size_t HttpDispatcher::active = 0;
+  std::deque<std::pair<HttpRequest *, int>> HttpDispatcher::completed;
+  std::thread HttpDispatcher::reactor;
+  std::vector<std::thread> HttpDispatcher::workers;
+  size_t HttpDispatcher::hostConcurrency = HttpDispatcher::DEFAULT_HOST_CONCURRENCY;
+  size_t HttpDispatcher::concurrency = HttpDispatcher::DEFAULT_CONCURRENCY;
+  bool HttpDispatcher::running = false;
+  bool HttpDispatcher::completing = false;
+  HttpDispatcher::Stats HttpDispatcher::stats;
+
+
+  void HttpDispatcher::Configure(size_t hostConcurrency, size_t concurrency)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    HttpDispatcher::hostConcurrency = hostConcurrency > 0 ? hostConcurrency : DEFAULT_HOST_CONCURRENCY;
+    HttpDispatcher::concurrency = concurrency > 0 ? concurrency : DEFAULT_CONCURRENCY;
+  }
+
+
+  void HttpDispatcher::Start()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (running)
+    {
+      return;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    multi = curl_multi_init();
+    if (!multi)
+    {
+      printf("Error: failed to create the http transport.\n");
+      curl_global_cleanup();
+      return;
+    }
+
+    HostLimit::Configure(hostConcurrency);
+
+    // Idle connections stay open for reuse, up to one per possible transfer
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(hostConcurrency));
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, static_cast<long>(concurrency));
+
+    running = true;
+    completing = true;
+
+    reactor = std::thread(ReactorProc);
+
+    for (size_t i = 0; i < COMPLETION_THREADS; ++i)
+    {
+      workers.emplace_back(CompletionProc);
+    }
+  }
+
+
+  void HttpDispatcher::Stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      if (!running)
+      {
+        return;
+      }
+
+      running = false;
+    }
+
+    // The reactor finishes the transfers in flight before it returns
+    Wakeup();
+    reactor.join();
+
+    std::vector<std::thread> threads;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      completing = false;
+      threads.swap(workers);
+    }
+
+    cond.notify_all();
+
+    for (auto & thread : threads)
+    {
+      thread.join();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    curl_multi_cleanup(multi);
+    multi = nullptr;
+
+    curl_global_cleanup();
+
+    for (auto & entry : hosts)
+    {
+      for (auto & queue : entry.second.pending)
+      {
+        for (auto request : queue)
+        {
+          delete request;
+        }
+      }
+    }
+
+    hosts.clear();
+  }
+
+
+  void HttpDispatcher::Enqueue(const std::string & host, HttpRequest * request)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Host & entry = hosts[host];
+    if (!entry.limit)
+    {
+      entry.limit = HostLimit::Get(host);
+    }
+
+    entry.pending[static_cast<size_t>(request->GetPriority())].emplace_back(request);
+
+    // Under the lock so that Stop cannot release the multi handle meanwhile
+    Wakeup();
+  }
+
+
+  Json::Value HttpDispatcher::GetStats()
+  {
+    Json::Value json;
+
+    json["counters"]["requests"] = Json::Value::UInt(stats.requests.Get());
+    json["counters"]["failures"] = Json::Value::UInt(stats.failures.Get());
+    json["counters"]["retries"] = Json::Value::UInt(stats.retries.Get());
+    json["counters"]["connections"] = Json::Value::UInt(stats.connections.Get());
+    json["counters"]["reusedConnections"] = Json::Value::UInt(stats.reused.Get());
+    json["latency"]["request"] = stats.latency.ToJson();
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    size_t pending[PRIORITY_CLASSES] = {};
+    for (const auto & entry : hosts)
+    {
+      for (size_t i = 0; i < PRIORITY_CLASSES; ++i)
+      {
+        pending[i] += entry.second.pending[i].size();
+      }
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < PRIORITY_CLASSES; ++i)
+    {
+      json["gauges"][std::string("pending") + classes[i]] = Json::Value::UInt(pending[i]);
+      total += pending[i];
+    }
+
+    json["gauges"]["activeTransfers"] = Json::Value::UInt(active);
+    json["gauges"]["pendingRequests"] = Json::Value::UInt(total);
+
+    return json;
+  }
+
+
+  void HttpDispatcher::Wakeup()
+  {
+#if LIBCURL_VERSION_NUM >= 0x074400
+    if (multi)
+    {
+      curl_multi_wakeup(multi);
+    }
+#endif
+  }
+
+
+  HttpRequest * HttpDispatcher::Next(std::string & host)
+  {
+    if (hosts.empty())
+    {
+      return nullptr;
+    }
+
+    auto start = hosts.upper_bound(cursor);
+    auto itr = start;
+
+    do
+    {
+      if (itr == hosts.end())
+      {
+        itr = hosts.begin();
+      }
+
+      HttpRequest * request = Pick(itr->second);
+      if (request)
+      {
+        ++itr->second.active;
+
+        host = itr->first;
+        cursor = itr->first;
+
+        return request;
+      }
+
+      ++itr;
+    } while (itr != start && !(start == hosts.end() && itr == hosts.end()));
+
+    return nullptr;
+  }
+
+
+  HttpRequest * HttpDispatcher::Pick(Host & host)
+  {
+    size_t limit = host.limit->GetLimit();
+    if (host.active >= limit)
+    {
+      return nullptr;
+    }
+
+    // Background classes leave the last free slot to more urgent work
+    bool spare = host.active + 1 < limit || limit == 1;
+
+    for (int round = 0; round < 2; ++round)
+    {
+      for (size_t i = 0; i < PRIORITY_CLASSES; ++i)
+      {
+        bool background = i >= static_cast<size_t>(Priority::Prefetch);
+        if (host.pending[i].empty() || host.credits[i] == 0 || (background && !spare))
+        {
+          continue;
+        }
+
+        --host.credits[i];
+
+        HttpRequest * request = host.pending[i].front();
+        host.pending[i].pop_front();
+        return request;
+      }
+
+      // Every class with work used up its share, start the next round
+      for (size_t i = 0; i < PRIORITY_CLASSES; ++i)
+      {
+        host.credits[i] = weights[i];
+      }
+    }
+
+    return nullptr;
+  }
+
+
+  bool HttpDispatcher::Host::Idle() const
+  {
+    if (this->active > 0)
+    {
+      return false;
+    }
+
+    for (const auto & queue : this->pending)
+    {
+      if (!queue.empty())
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  bool HttpDispatcher::Add(Transfer * transfer)
+  {
+    CURL * curl = transfer->request->Prepare();
+    if (!curl)
+    {
+      return false;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+
+    if (curl_multi_add_handle(multi, curl) != CURLM_OK)
+    {
+      transfer->request->Release(curl);
+      return false;
+    }
+
+    return true;
+  }
+
+
+  static bool isunreachable(int code)
+  {
+    return code == CURLE_COULDNT_RESOLVE_PROXY ||
+           code == CURLE_COULDNT_RESOLVE_HOST ||
+           code == CURLE_COULDNT_CONNECT ||
+           code == CURLE_OPERATION_TIMEDOUT ||
+           code == CURLE_SEND_ERROR ||
+           code == CURLE_RECV_ERROR ||
+           code == CURLE_GOT_NOTHING;
+  }
+
+
+  void HttpDispatcher::Finish(Transfer * transfer, int code)
+  {
+    uint64_t micros = transfer->watch.ElapsedMicros();
+
+    stats.requests.Add();
+    stats.latency.Record(micros);
+
+    if (code != CURLE_OK)
+    {
+      stats.failures.Add();
+    }
+
+    // Aborted transfers say nothing about the host, only those that could not reach it count
+    if (code == CURLE_OK)
+    {
+      HostHealth::Get(transfer->host)->OnSuccess();
+    }
+    else if (isunreachable(code))
+    {
+      HostHealth::Get(transfer->host)->OnFailure();
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      --active;
+
+      auto itr = hosts.find(transfer->host);
+      if (itr != hosts.end())
+      {
+        if (code == CURLE_OK || isunreachable(code))
+        {
+          itr->second.limit->OnComplete(micros, code == CURLE_OK, itr->second.active - 1);
+        }
+
+        --itr->second.active;
+
+        if (itr->second.Idle())
+        {
+          hosts.erase(itr);
+        }
+      }
+
+      completed.emplace_back(transfer->request, code);
+    }
+
+    cond.notify_one();
+
+    delete transfer;
+  }
+
+
+  void HttpDispatcher::ReactorProc()
+  {
+    std::vector<Transfer *> starting;
+
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (!running && active == 0)
+        {
+          break;
+        }
+
+        while (running && active < concurrency)
+        {
+          std::string host;
+          HttpRequest * request = Next(host);
+          if (!request)
+          {
+            break;
+          }
+
+          ++active;
+
+          Transfer * transfer = new Transfer();
+          transfer->request = request;
+          transfer->host = host;
+          starting.emplace_back(transfer);
+        }
+      }
+
+      for (auto transfer : starting)
+      {
+        transfer->request->Begin();
+
+        if (!Add(transfer))
+        {
+          Finish(transfer, CURLE_FAILED_INIT);
+        }
+      }
+
+      starting.clear();
+
+      int transfers = 0;
+      curl_multi_perform(multi, &transfers);
+
+      CURLMsg * msg = nullptr;
+      int left = 0;
+      while ((msg = curl_multi_info_read(multi, &left)) != nullptr)
+      {
+        if (msg->msg != CURLMSG_DONE)
+        {
+          continue;
+        }
+
+        CURL * curl = msg->easy_handle;
+        int code = msg->data.result;
+
+        Transfer * transfer = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, reinterpret_cast<char **>(&transfer));
+
+        // No new connection means the transfer went over one kept alive from before
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        if (connects > 0)
+        {
+          stats.connections.Add(static_cast<uint64_t>(connects));
+        }
+        else if (code == CURLE_OK)
+        {
+          stats.reused.Add();
+        }
+
+        curl_multi_remove_handle(multi, curl);
+        transfer->request->Release(curl);
+
+        // A connection failure moves on to the next relay, if there is one
+        if (transfer->request->Continue(code))
+        {
+          stats.retries.Add();
+
+          if (Add(transfer))
+          {
+            continue;
+          }
+
+          code = CURLE_FAILED_INIT;
+        }
+
+        Finish(transfer, code);
+      }
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+      curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+#else
+      // Without curl_multi_wakeup new requests are only noticed on the next round
+      curl_multi_wait(multi, nullptr, 0, 10, nullptr);
+#endif
+    }
+  }
+
+
+  void HttpDispatcher::CompletionProc()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+      cond.wait(lock, []() {
+        return !completing || !completed.empty();
+      });
+
+      if (completed.empty())
+      {
+        return;
+      }
+
+      auto item = completed.front();
+      completed.pop_front();
+
+      lock.unlock();
+
+      item.first->Complete(item.second);
+      delete item.first;
+
+      lock.lock();
+    }
+  }
+}
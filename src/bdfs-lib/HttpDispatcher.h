@@ -0,0 +1,160 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <json/json.h>
+#include "Stats.h"
+#include "HostLimit.h"
+#include "Priority.h"
+
+namespace bdfs
+{
+  class HttpRequest;
+
+  // Runs the requests of all sessions on one libcurl multi handle. Transfers
+  // are driven by a single reactor thread and the multi handle keeps a pool
+  // of keep-alive connections per host, so consecutive requests to a host go
+  // over a connection that is already set up (including any TLS handshake or
+  // SOCKS negotiation through a relay).
+  //
+  // Each host gets its own queues and may have at most as many transfers in
+  // flight as its HostLimit currently allows, up to a configured maximum, so
+  // a slow host cannot take every slot and requests to different hosts never
+  // wait for each other. Hosts with pending requests are served round robin.
+  // Within a host every priority class has its own queue. The classes share
+  // the free slots by weight, most urgent first, and the background classes
+  // never take the last free slot of a host, so a foreground request skips
+  // queued background work and finds room soon. Completion callbacks run on
+  // a few separate threads so that a callback that blocks never stalls the
+  // reactor.
+  class HttpDispatcher
+  {
+  private:
+
+    struct Host
+    {
+      std::deque<HttpRequest *> pending[PRIORITY_CLASSES];
+      // Requests each class may still start in the current round
+      uint32_t credits[PRIORITY_CLASSES] = {};
+      size_t active = 0;
+      std::shared_ptr<HostLimit> limit;
+
+      bool Idle() const;
+    };
+
+    struct Transfer
+    {
+      HttpRequest * request;
+      std::string host;
+      StopWatch watch;
+    };
+
+  public:
+
+    // Upper bound of the adaptive limit of each host
+    static const size_t DEFAULT_HOST_CONCURRENCY = 32;
+
+    static const size_t DEFAULT_CONCURRENCY = 1024;
+
+    static const size_t COMPLETION_THREADS = 4;
+
+    // Takes effect on the next Start
+    static void Configure(size_t hostConcurrency, size_t concurrency);
+
+    static void Start();
+
+    // Waits for the transfers in flight and drops the requests still queued
+    static void Stop();
+
+    // Takes ownership of the request and deletes it once it completed. The
+    // host is the base url of the session the request belongs to.
+    static void Enqueue(const std::string & host, HttpRequest * request);
+
+    // Process wide transfer and connection reuse statistics
+    static Json::Value GetStats();
+
+  private:
+
+    static void ReactorProc();
+
+    static void CompletionProc();
+
+    static HttpRequest * Next(std::string & host);
+
+    static HttpRequest * Pick(Host & host);
+
+    static bool Add(Transfer * transfer);
+
+    static void Finish(Transfer * transfer, int code);
+
+    static void Wakeup();
+
+  private:
+
+    static std::mutex mutex;
+
+    static std::condition_variable cond;
+
+    static std::map<std::string, Host> hosts;
+
+    // Host served last, the next one after it goes first
+    static std::string cursor;
+
+    // Transfers handed to the multi handle
+    static size_t active;
+
+    static std::deque<std::pair<HttpRequest *, int>> completed;
+
+    static std::thread reactor;
+
+    static std::vector<std::thread> workers;
+
+    static size_t hostConcurrency;
+
+    static size_t concurrency;
+
+    static bool running;
+
+    // Completion threads keep going until the reactor has handed over its last transfer
+    static bool completing;
+
+    static struct Stats
+    {
+      Counter requests;
+      Counter failures;
+      Counter retries;
+      Counter connections;
+      Counter reused;
+      Histogram latency;
+    } stats;
+  };
+}
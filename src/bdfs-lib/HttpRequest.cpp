@@ -22,6 +22,7 @@
 
 #include "PlatformHelper.h"
 #include "HttpRequest.h"
+#include "PathRacer.h"
 
 #include <sstream>
 #include <curl/curl.h>
@@ -82,6 +83,10 @@ namespace bdfs
 
   HttpRequest::~HttpRequest()
   {
+    if (this->headers)
+    {
+      curl_slist_free_all(this->headers);
+    }
   }
 
   size_t __HeaderCallback(void * ptr, size_t size, size_t count, void * context)
@@ -99,85 +104,112 @@ namespace bdfs
     size_t realSize = size * count;
     if (realSize > 0)
     {
-      ((HttpRequest*)context)->bodyCallback((char*)ptr, realSize);
+      if (!((HttpRequest*)context)->bodyCallback((char*)ptr, realSize))
+      {
+        return 0;
+      }
     }
     return realSize;
   }
 
-
-  void HttpRequest::Execute()
+  size_t __ReadCallback(char * ptr, size_t size, size_t count, void * context)
   {
-    auto & relays = this->config->Relays();
+    return ((HttpRequest*)context)->ReadUpload(ptr, size * count);
+  }
+
 
-#if 0
-    if (this->config->ActiveRelay() >= static_cast<int>(relays.size()))
+  size_t HttpRequest::ReadUpload(char * ptr, size_t size)
+  {
+    size = std::min(size, this->upload->Size() - this->uploaded);
+    if (size > 0 && !this->upload->Read(this->uploaded, ptr, size))
     {
-      // Reset relay since all endpoints failed before. We should retry from beginning.
-      this->config->ActiveRelay(-1);
-      this->config->ActiveRelayEndpoint(-1);
+      return CURL_READFUNC_ABORT;
     }
-#endif
 
+    this->uploaded += size;
+    return size;
+  }
+
+
+  void HttpRequest::Execute()
+  {
 #ifdef DEBUG_HTTP_RELAY
     printf("HttpRequest::Execute: %s\n", this->url.c_str());
 #endif
 
     int rtn = CURLE_OK;
-    bool tryingRelays = this->config->ActiveRelay() < 0;
-    if (this->config->ActiveRelay() >= static_cast<int>(relays.size()))
+
+    this->Begin();
+
+    do
     {
 #ifdef DEBUG_HTTP_RELAY
-      printf("HttpRequest::ExecuteImpl: activeRelay=%d activeEp=%d\n", this->config->ActiveRelay(), this->config->ActiveRelayEndpoint());
-#endif      
+      printf("HttpRequest::ExecuteImpl: trying relay=%d ep=%d\n", this->route.relay, this->route.endpoint);
+#endif
       rtn = this->ExecuteImpl();
-    }
-    else
+    } while (this->Continue(rtn));
+
+    this->Complete(rtn);
+  }
+
+
+  void HttpRequest::Begin()
+  {
+    this->route = this->config->Paths().Pick(&this->generation);
+    this->switched = false;
+  }
+
+
+  bool HttpRequest::Continue(int code)
+  {
+    if (code != CURLE_COULDNT_RESOLVE_PROXY &&
+        code != CURLE_COULDNT_RESOLVE_HOST &&
+        code != CURLE_COULDNT_CONNECT &&
+        code != CURLE_REMOTE_ACCESS_DENIED &&
+        code != CURLE_OPERATION_TIMEDOUT &&
+        code != CURLE_SEND_ERROR)
     {
-      while (this->config->ActiveRelay() < static_cast<int>(relays.size()))
-      {
-#ifdef DEBUG_HTTP_RELAY
-        printf("HttpRequest::ExecuteImpl: trying activeRelay=%d activeEp=%d\n", this->config->ActiveRelay(), this->config->ActiveRelayEndpoint());
-#endif
-        rtn = this->ExecuteImpl();
-        if (!tryingRelays)
-        {
-          break;
-        }
+      // TODO: maybe we should handle more errors like ssl handshake to make sure we were
+      // trying to connect to the right server
+      return false;
+    }
 
-        if (rtn != CURLE_COULDNT_RESOLVE_PROXY &&
-            rtn != CURLE_COULDNT_RESOLVE_HOST &&
-            rtn != CURLE_COULDNT_CONNECT &&
-            rtn != CURLE_REMOTE_ACCESS_DENIED &&
-            rtn != CURLE_OPERATION_TIMEDOUT &&
-            rtn != CURLE_SEND_ERROR)
-        {
-          // TODO: maybe we should handle more errors like ssl handshake to make sure we were
-          // trying to connect to the right server
-          break;
-        }
+    // Other paths take over at once, the failed one is raced again in the background
+    this->config->Paths().OnFailure(this->route);
+    PathRacer::Invalidate(this->config);
 
-        if (this->config->ActiveRelay() < 0 ||
-            this->config->ActiveRelayEndpoint() >= static_cast<int>(relays[this->config->ActiveRelay()].endpoints.size()) - 1)
-        {
-          do
-          {
-            this->config->ActiveRelay(this->config->ActiveRelay() + 1);
-            this->config->ActiveRelayEndpoint(0);
-          } while (this->config->ActiveRelay() < static_cast<int>(relays.size()) &&
-                  relays[this->config->ActiveRelay()].endpoints.size() == 0);
-        }
-        else
-        {
-          this->config->ActiveRelayEndpoint(this->config->ActiveRelayEndpoint() + 1);
-        }
-      }
+    if (this->switched)
+    {
+      return false;
     }
 
+    uint32_t generation = 0;
+    HttpConfig::Path current = this->config->Paths().Pick(&generation);
+    if (generation == this->generation)
+    {
+      return false;
+    }
+
+    this->route = current;
+    this->generation = generation;
+    this->switched = true;
+
+    return true;
+  }
+
+
+  void HttpRequest::Complete(int code)
+  {
 #ifdef DEBUG_HTTP_RELAY
-    printf("HttpRequest::ExecuteImpl: curl_code=%d activeRelay=%d activeEp=%d\n", rtn, this->config->ActiveRelay(), this->config->ActiveRelayEndpoint());
+    printf("HttpRequest::ExecuteImpl: curl_code=%d relay=%d ep=%d\n", code, this->route.relay, this->route.endpoint);
 #endif
 
-    completeCallback(rtn != CURLE_OK);
+    if (code == CURLE_OK)
+    {
+      this->config->Paths().OnResult(this->route, this->transferred, this->elapsed);
+    }
+
+    completeCallback(code != CURLE_OK);
   }
 
 
@@ -213,41 +245,26 @@ namespace bdfs
   }
 
 
-  int HttpRequest::ExecuteImpl()
+  void HttpRequest::ApplyPath(CURL * curl, const std::string & url, HttpConfig * config, const HttpConfig::Path & path)
   {
-    CURL * curl = curl_easy_init();
-    if (curl == NULL)
-    {
-      completeCallback(true);
-      return -1;
-    }
-#if !(defined(_WIN32) || defined(_WIN64))
-  //  curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, HttpClient::CurlOpenSocketCallback);
-#endif
-
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, config->ConnectTimeout());
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, config->RequestTimeout());
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, config->UserAgent().c_str());
-    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-
     std::string altHost;
-    auto & relays = this->config->Relays();
+    auto & relays = config->Relays();
 
-    if (this->config->ActiveRelay() >= 0 &&
-        this->config->ActiveRelay() < static_cast<int>(relays.size()) &&
-        this->config->ActiveRelayEndpoint() >= 0 &&
-        this->config->ActiveRelayEndpoint() < static_cast<int>(relays[this->config->ActiveRelay()].endpoints.size()))
+    if (path.relay >= 0 &&
+        path.relay < static_cast<int>(relays.size()) &&
+        path.endpoint >= 0 &&
+        path.endpoint < static_cast<int>(relays[path.relay].endpoints.size()))
     {
-      auto & endpoint = relays[this->config->ActiveRelay()].endpoints[this->config->ActiveRelayEndpoint()];
+      auto & endpoint = relays[path.relay].endpoints[path.endpoint];
       if (!endpoint.host.empty() && endpoint.socksPort > 0)
       {
         char relay[BUFSIZ];
         snprintf(relay, sizeof(relay), "socks5h://%s:%u", endpoint.host.c_str(), endpoint.socksPort);
         curl_easy_setopt(curl, CURLOPT_PROXY, relay);
 
-        if (!relays[this->config->ActiveRelay()].name.empty())
+        if (!relays[path.relay].name.empty())
         {
-          altHost = relays[this->config->ActiveRelay()].name;
+          altHost = relays[path.relay].name;
         }
       }
     }
@@ -267,6 +284,55 @@ namespace bdfs
 #endif      
       curl_easy_setopt(curl, CURLOPT_URL, altUrl.c_str());
     }
+  }
+
+
+  int HttpRequest::ExecuteImpl()
+  {
+    CURL * curl = this->Prepare();
+    if (curl == NULL)
+    {
+      return CURLE_FAILED_INIT;
+    }
+
+    CURLcode res = curl_easy_perform(curl);
+
+    this->Release(curl);
+
+    return res;
+  }
+
+
+  CURL * HttpRequest::Prepare()
+  {
+    if (this->startCallback)
+    {
+      this->startCallback();
+    }
+
+    CURL * curl = curl_easy_init();
+    if (curl == NULL)
+    {
+      return NULL;
+    }
+#if !(defined(_WIN32) || defined(_WIN64))
+  //  curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, HttpClient::CurlOpenSocketCallback);
+#endif
+
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, config->ConnectTimeout());
+    if (this->timeout > 0)
+    {
+      curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(this->timeout));
+    }
+    else
+    {
+      curl_easy_setopt(curl, CURLOPT_TIMEOUT, config->RequestTimeout());
+    }
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, config->UserAgent().c_str());
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+    ApplyPath(curl, this->url, this->config, this->route);
 
     if(!range.empty())
     {
@@ -274,7 +340,24 @@ namespace bdfs
     }
 
     struct curl_slist * headers = nullptr;
-    if (!this->postdata.empty())
+    if (this->headers)
+    {
+      curl_slist_free_all(this->headers);
+      this->headers = nullptr;
+    }
+
+    if (this->upload)
+    {
+      this->uploaded = 0;
+
+      curl_easy_setopt(curl, CURLOPT_POST, 1L);
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(this->upload->Size()));
+      curl_easy_setopt(curl, CURLOPT_READFUNCTION, __ReadCallback);
+      curl_easy_setopt(curl, CURLOPT_READDATA, this);
+
+      headers = curl_slist_append(headers, "Expect:");
+    }
+    else if (!this->postdata.empty())
     {
 #ifdef DEBUG_HTTP
       printf("POST: %s\n", this->postdata.c_str());
@@ -295,6 +378,8 @@ namespace bdfs
 
     if (headers)
     {
+      // Must outlive the transfer, Release frees it
+      this->headers = headers;
       curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     }
 
@@ -337,11 +422,29 @@ namespace bdfs
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, __BodyCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
 
-    CURLcode res = curl_easy_perform(curl);
+    return curl;
+  }
+
+
+  void HttpRequest::Release(CURL * curl)
+  {
+    curl_off_t downloaded = 0;
+    curl_off_t uploaded = 0;
+    curl_off_t micros = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &micros);
+
+    this->transferred = static_cast<uint64_t>(downloaded + uploaded);
+    this->elapsed = static_cast<uint64_t>(micros);
 
     curl_easy_cleanup(curl);
 
-    return res;
+    if (this->headers)
+    {
+      curl_slist_free_all(this->headers);
+      this->headers = nullptr;
+    }
   }
 
   void HttpRequest::Get(JsonCallback callback)
@@ -350,6 +453,11 @@ namespace bdfs
 
     bodyCallback = [=](char* ptr, size_t size){
       body->write(ptr, size);
+      return true;
+    };
+
+    startCallback = [=]() {
+      body->str(std::string());
     };
 
     completeCallback = [=](bool isError) {
@@ -382,6 +490,11 @@ namespace bdfs
 
     bodyCallback = [=](char* ptr, size_t size){
       body->write(ptr, size);
+      return true;
+    };
+
+    startCallback = [=]() {
+      body->str(std::string());
     };
 
     completeCallback = [=](bool isError) {
@@ -399,6 +512,29 @@ namespace bdfs
   }
 
 
+  void HttpRequest::Get(ReceiveBufferPtr buffer, BufferCallback callback)
+  {
+    bodyCallback = [=](char* ptr, size_t size){
+      // Error responses carry a json body, which must not end up in the buffer
+      auto itr = responseHeaders.find("content-type");
+      if (itr == responseHeaders.end() || itr->second.compare(0, 24, "application/octet-stream") != 0)
+      {
+        return false;
+      }
+
+      return buffer->Write(ptr, size);
+    };
+
+    startCallback = [=]() {
+      buffer->Rewind();
+    };
+
+    completeCallback = [=](bool isError) {
+      callback(isError ? 0 : buffer->Size(), isError);
+    };
+  }
+
+
   static std::string postImpl(const Json::Value & data)
   {
     std::stringstream rs;
@@ -443,6 +579,13 @@ namespace bdfs
   }
 
 
+  void HttpRequest::Post(const Json::Value & data, ReceiveBufferPtr buffer, BufferCallback callback)
+  {
+    this->postdata = postImpl(data);
+    this->Get(buffer, callback);
+  }
+
+
   void HttpRequest::Post(const char * type, const void * buf, size_t len, JsonCallback callback)
   {
     if (!buf || len == 0)
@@ -477,6 +620,23 @@ namespace bdfs
   }
 
 
+  void HttpRequest::Post(const char * type, SendBufferPtr body, JsonCallback callback)
+  {
+    if (!body || body->Size() == 0)
+    {
+      return;
+    }
+
+    if (type)
+    {
+      this->contentType = type;
+    }
+
+    this->upload = std::move(body);
+    this->Get(callback);
+  }
+
+
   char * HttpRequest::EncodeStr(const char* str)
   {
     CURL * curl = curl_easy_init();
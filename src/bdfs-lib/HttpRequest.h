@@ -23,16 +23,21 @@
 #pragma once
 
 #include "HttpConfig.h"
+#include "ReceiveBuffer.h"
+#include "SendBuffer.h"
+#include "Priority.h"
 
 #include <string>
 #include <map>
 #include <functional>
 #include "json/json.h"
+#include <curl/curl.h>
 
 namespace bdfs
 {
   typedef std::function<void(Json::Value &, bool)> JsonCallback;
   typedef std::function<void(std::string &&, bool)> RawCallback;
+  typedef std::function<void(size_t, bool)> BufferCallback;
 
   class HttpRequest
   {
@@ -46,6 +51,10 @@ namespace bdfs
     std::string contentType;
     std::string postdata;
 
+    // Streamed body, used instead of postdata when set
+    SendBufferPtr upload;
+    size_t uploaded = 0;
+
     std::string range;
 
     std::map<std::string,std::string> requestHeaders;
@@ -53,16 +62,41 @@ namespace bdfs
 
     std::string proxy;
 
+    // Per attempt deadline in milliseconds overriding the configured request timeout
+    uint32_t timeout = 0;
+
+    // Class of the thread that created the request
+    Priority priority = PriorityScope::Current();
+
+    struct curl_slist * headers = nullptr;
+
+    // Path taken by the request, see Begin and Continue
+    HttpConfig::Path route;
+    uint32_t generation = 0;
+    bool switched = false;
+
+    // Size and duration of the last attempt, reported as throughput of its path
+    uint64_t transferred = 0;
+    uint64_t elapsed = 0;
+
   public:
-    std::function<void(char*,size_t)> bodyCallback;
+    // Returning false aborts the transfer with an error
+    std::function<bool(char*,size_t)> bodyCallback;
     std::function<void(char*,size_t)> headerCallback;
     std::function<void(bool)> completeCallback;
+    // Invoked before every attempt, so that a retry does not append to a partial body
+    std::function<void()> startCallback;
 
     HttpRequest(const char * url, HttpConfig * config);
     ~HttpRequest();
 
+    HttpRequest(const HttpRequest &) = delete;
+    HttpRequest & operator=(const HttpRequest &) = delete;
+
     void Execute();
     std::string & Url() { return url; }
+    void SetTimeout(uint32_t ms) { timeout = ms; }
+    Priority GetPriority() const { return priority; }
     std::map<std::string,std::string> & RequestHeaders() { return requestHeaders; }
     std::map<std::string,std::string> & ResponseHeaders() { return responseHeaders; }
 
@@ -76,9 +110,34 @@ namespace bdfs
     void Post(const char * type, const void * buf, size_t len, JsonCallback callback);
     void Post(const char * type, const void * buf, size_t len, RawCallback callback);
 
+    // The body is read from the caller's buffer while it is sent, see SendBuffer
+    void Post(const char * type, SendBufferPtr body, JsonCallback callback);
+
+    // The body is written straight into the buffer. The callback receives the
+    // number of bytes received, and an error if the body did not fit or the
+    // response was not application/octet-stream.
+    void Get(ReceiveBufferPtr buffer, BufferCallback callback);
+    void Post(const Json::Value & data, ReceiveBufferPtr buffer, BufferCallback callback);
+
     static char * EncodeStr(const char* str);
     static void FreeEncodedStr(char * str);
 
+    // Points the handle at the url through the given path
+    static void ApplyPath(CURL * curl, const std::string & url, HttpConfig * config, const HttpConfig::Path & path);
+
+    // The steps of Execute for callers that drive the transfer themselves:
+    // Begin once, then Prepare an easy handle, run it and Release it for as
+    // long as Continue asks for another attempt over a newly chosen path,
+    // and finally Complete with the result of the last attempt.
+    void Begin();
+    CURL * Prepare();
+    void Release(CURL * curl);
+    bool Continue(int code);
+    void Complete(int code);
+
+    // Fills the next piece of a streamed body, for the curl read callback
+    size_t ReadUpload(char * ptr, size_t size);
+
   private:
 
     int ExecuteImpl();
@@ -0,0 +1,210 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "LatencyTracker.h"
+
+namespace bdfs
+{
+  // Weight of a new sample in the moving average
+  static const double EWMA_WEIGHT = 0.1;
+
+  std::mutex LatencyTracker::trackersMutex;
+  std::map<std::string, std::shared_ptr<LatencyTracker>> LatencyTracker::trackers;
+
+
+  static std::string hostfromurl(const std::string & url)
+  {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of("/?#", start);
+
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+  }
+
+
+  std::shared_ptr<LatencyTracker> LatencyTracker::Get(const std::string & url)
+  {
+    std::string host = hostfromurl(url);
+
+    std::unique_lock<std::mutex> lock(trackersMutex);
+
+    auto & tracker = trackers[host];
+    if (!tracker)
+    {
+      tracker = std::make_shared<LatencyTracker>();
+    }
+
+    return tracker;
+  }
+
+
+  Json::Value LatencyTracker::GetStats()
+  {
+    Json::Value json(Json::objectValue);
+
+    std::unique_lock<std::mutex> lock(trackersMutex);
+
+    for (const auto & entry : trackers)
+    {
+      json["host " + entry.first] = entry.second->ToJson();
+    }
+
+    return json;
+  }
+
+
+  size_t LatencyTracker::BucketOf(uint64_t micros)
+  {
+    if (micros < SUB_BUCKETS)
+    {
+      return static_cast<size_t>(micros);
+    }
+
+    size_t msb = 0;
+    while ((micros >> (msb + 1)) != 0)
+    {
+      ++msb;
+    }
+
+    // The two bits below the most significant one pick the sub bucket
+    size_t sub = static_cast<size_t>(micros >> (msb - 2)) & (SUB_BUCKETS - 1);
+
+    return std::min((msb - 1) * SUB_BUCKETS + sub, BUCKETS - 1);
+  }
+
+
+  uint64_t LatencyTracker::UpperBound(size_t bucket)
+  {
+    if (bucket < SUB_BUCKETS)
+    {
+      return bucket + 1;
+    }
+
+    size_t msb = bucket / SUB_BUCKETS + 1;
+    size_t sub = bucket % SUB_BUCKETS;
+
+    return static_cast<uint64_t>(SUB_BUCKETS + sub + 1) << (msb - 2);
+  }
+
+
+  void LatencyTracker::Record(uint64_t micros, bool success)
+  {
+    this->samples.Add();
+    if (!success)
+    {
+      this->failures.Add();
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->currentCount >= WINDOW)
+    {
+      memcpy(this->previous, this->current, sizeof(this->current));
+      memset(this->current, 0, sizeof(this->current));
+      this->previousCount = this->currentCount;
+      this->currentCount = 0;
+    }
+
+    ++this->current[BucketOf(micros)];
+    ++this->currentCount;
+
+    if (this->previousCount + this->currentCount == 1)
+    {
+      this->ewma = static_cast<double>(micros);
+    }
+    else
+    {
+      this->ewma += EWMA_WEIGHT * (static_cast<double>(micros) - this->ewma);
+    }
+  }
+
+
+  uint64_t LatencyTracker::Quantile(double quantile) const
+  {
+    uint64_t total = this->previousCount + this->currentCount;
+    if (total == 0)
+    {
+      return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(quantile * total);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+      seen += this->current[i] + this->previous[i];
+      if (seen > target)
+      {
+        return UpperBound(i);
+      }
+    }
+
+    return UpperBound(BUCKETS - 1);
+  }
+
+
+  uint32_t LatencyTracker::GetDeadline(uint32_t limit) const
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->previousCount + this->currentCount < MIN_SAMPLES)
+    {
+      return limit;
+    }
+
+    uint64_t deadline = DEADLINE_FACTOR * this->Quantile(0.99) / 1000;
+
+    return static_cast<uint32_t>(std::min<uint64_t>(std::max<uint64_t>(deadline, MIN_DEADLINE_MS), limit));
+  }
+
+
+  uint32_t LatencyTracker::GetHedgeDelay() const
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->previousCount + this->currentCount < MIN_SAMPLES)
+    {
+      return 0;
+    }
+
+    return static_cast<uint32_t>((this->Quantile(0.95) + 999) / 1000);
+  }
+
+
+  Json::Value LatencyTracker::ToJson() const
+  {
+    Json::Value json;
+    json["counters"]["requests"] = Json::Value::UInt(this->samples.Get());
+    json["counters"]["failures"] = Json::Value::UInt(this->failures.Get());
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    json["gauges"]["ewmaUs"] = this->ewma;
+    json["gauges"]["p50Us"] = Json::Value::UInt(this->Quantile(0.5));
+    json["gauges"]["p99Us"] = Json::Value::UInt(this->Quantile(0.99));
+
+    return json;
+  }
+}
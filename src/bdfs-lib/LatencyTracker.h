@@ -0,0 +1,106 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <json/json.h>
+#include "Stats.h"
+
+namespace bdfs
+{
+  // Latency of the block requests to one host. Keeps an EWMA and a quantile
+  // sketch over the recent requests, from which the deadline of the next
+  // request is derived instead of using the configured worst case.
+  class LatencyTracker
+  {
+  public:
+
+    // Returns the tracker of the host of the given url, creating it on first use
+    static std::shared_ptr<LatencyTracker> Get(const std::string & url);
+
+    // {"host <name>": {...}} for all hosts, in the layout of the other stats
+    static Json::Value GetStats();
+
+    // Records a completed request, failed ones include those that ran into their deadline
+    void Record(uint64_t micros, bool success);
+
+    // Milliseconds one attempt is given. Until enough samples have been seen
+    // this is the limit, afterwards a multiple of the observed p99 capped by it.
+    uint32_t GetDeadline(uint32_t limit) const;
+
+    // Milliseconds after which a read that has not completed is hedged, the
+    // observed p95. Zero until enough samples have been seen.
+    uint32_t GetHedgeDelay() const;
+
+    Json::Value ToJson() const;
+
+  private:
+
+    // Log linear buckets, each power of two is split in SUB_BUCKETS
+    static const size_t SUB_BUCKETS = 4;
+
+    static const size_t BUCKETS = 40 * SUB_BUCKETS;
+
+    // The sketch covers the current and the previous window of this many samples
+    static const uint64_t WINDOW = 1024;
+
+    static const uint64_t MIN_SAMPLES = 32;
+
+    static const uint32_t MIN_DEADLINE_MS = 250;
+
+    static const uint32_t DEADLINE_FACTOR = 3;
+
+    static size_t BucketOf(uint64_t micros);
+
+    static uint64_t UpperBound(size_t bucket);
+
+    uint64_t Quantile(double quantile) const;
+
+  private:
+
+    mutable std::mutex mutex;
+
+    uint64_t current[BUCKETS] = {};
+
+    uint64_t previous[BUCKETS] = {};
+
+    uint64_t currentCount = 0;
+
+    uint64_t previousCount = 0;
+
+    double ewma = 0;
+
+    Counter samples;
+
+    Counter failures;
+
+    static std::mutex trackersMutex;
+
+    static std::map<std::string, std::shared_ptr<LatencyTracker>> trackers;
+  };
+}
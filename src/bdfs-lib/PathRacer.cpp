@@ -0,0 +1,361 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <chrono>
+#include <algorithm>
+#include "PathRacer.h"
+#include "HttpRequest.h"
+
+#include <curl/curl.h>
+
+namespace bdfs
+{
+  std::mutex PathRacer::mutex;
+  std::condition_variable PathRacer::cond;
+  std::map<HttpConfig *, PathRacer::Entry> PathRacer::entries;
+  HttpConfig * PathRacer::racing = nullptr;
+  std::thread PathRacer::racer;
+  bool PathRacer::running = false;
+
+
+  uint64_t PathRacer::Now()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+
+  void PathRacer::Start()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (running)
+    {
+      return;
+    }
+
+    running = true;
+    racer = std::thread(RaceProc);
+  }
+
+
+  void PathRacer::Stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      if (!running)
+      {
+        return;
+      }
+
+      running = false;
+    }
+
+    cond.notify_all();
+    racer.join();
+  }
+
+
+  static std::string hostfromurl(const std::string & url)
+  {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of("/?#", start);
+
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+  }
+
+
+  Json::Value PathRacer::GetStats()
+  {
+    Json::Value json(Json::objectValue);
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (const auto & entry : entries)
+    {
+      json["host " + hostfromurl(entry.second.url)] = entry.first->Paths().GetStats();
+    }
+
+    return json;
+  }
+
+
+  void PathRacer::Add(const std::string & url, HttpConfig * config)
+  {
+    if (!config || config->Relays().empty())
+    {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Entry & entry = entries[config];
+    entry.url = url;
+    entry.due = 0;
+
+    cond.notify_all();
+  }
+
+
+  void PathRacer::Remove(HttpConfig * config)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (racing == config)
+    {
+      cond.wait(lock);
+    }
+
+    entries.erase(config);
+  }
+
+
+  void PathRacer::Invalidate(HttpConfig * config)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto itr = entries.find(config);
+    if (itr == entries.end())
+    {
+      return;
+    }
+
+    uint64_t soon = itr->second.last + RETRY_INTERVAL_MS;
+    if (itr->second.due > soon)
+    {
+      itr->second.due = soon;
+      cond.notify_all();
+    }
+  }
+
+
+  void PathRacer::RaceProc()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (running)
+    {
+      uint64_t now = Now();
+      uint64_t next = now + REPROBE_INTERVAL_MS;
+
+      HttpConfig * config = nullptr;
+      std::string url;
+
+      for (const auto & entry : entries)
+      {
+        if (entry.second.due <= now)
+        {
+          config = entry.first;
+          url = entry.second.url;
+          break;
+        }
+
+        next = std::min(next, entry.second.due);
+      }
+
+      if (!config)
+      {
+        cond.wait_for(lock, std::chrono::milliseconds(next - now));
+        continue;
+      }
+
+      // Failures reported during the race are about the old path
+      entries[config].due = UINT64_MAX;
+      entries[config].last = UINT64_MAX - RETRY_INTERVAL_MS;
+      racing = config;
+
+      lock.unlock();
+      bool found = Race(url, config);
+      lock.lock();
+
+      racing = nullptr;
+      cond.notify_all();
+
+      auto itr = entries.find(config);
+      if (itr != entries.end())
+      {
+        itr->second.last = Now();
+        itr->second.due = itr->second.last + (found ? REPROBE_INTERVAL_MS : RETRY_INTERVAL_MS);
+      }
+    }
+  }
+
+
+  bool PathRacer::Race(const std::string & url, HttpConfig * config)
+  {
+    // The direct url goes first, then the endpoints of the relays in the order they were given
+    std::vector<HttpConfig::Path> candidates(1);
+
+    auto & relays = config->Relays();
+    for (int i = 0; i < static_cast<int>(relays.size()) && candidates.size() < MAX_CANDIDATES; ++i)
+    {
+      for (int j = 0; j < static_cast<int>(relays[i].endpoints.size()) && candidates.size() < MAX_CANDIDATES; ++j)
+      {
+        if (!relays[i].endpoints[j].host.empty() && relays[i].endpoints[j].socksPort > 0)
+        {
+          HttpConfig::Path path;
+          path.relay = i;
+          path.endpoint = j;
+          candidates.emplace_back(path);
+        }
+      }
+    }
+
+    CURLM * multi = curl_multi_init();
+    if (!multi)
+    {
+      return false;
+    }
+
+    std::vector<CURL *> handles(candidates.size(), nullptr);
+
+    // Candidates that connected, in the order they did
+    std::vector<HttpConfig::Path> connected;
+    std::vector<uint64_t> rtts;
+
+    // A host that reported its url reachable gets the direct path to itself unless it fails
+    bool hinted = config->DirectHint();
+    uint64_t stagger = hinted ? 1000 * config->ConnectTimeout() : STAGGER_MS;
+
+    size_t started = 0;
+    size_t finished = 0;
+
+    uint64_t begin = Now();
+    uint64_t deadline = begin + 1000 * config->ConnectTimeout() + stagger * candidates.size();
+
+    while (finished < candidates.size() && Now() < deadline && !(hinted && !connected.empty() && connected[0].IsDirect()))
+    {
+      // The next candidate starts after its stagger, or at once when all those before it finished.
+      // Once there is a winner the rest only gets a short window to join it.
+      while (started < candidates.size() && (started == finished || !connected.empty() || Now() >= begin + stagger * started))
+      {
+        CURL * curl = curl_easy_init();
+        if (!curl)
+        {
+          ++started;
+          ++finished;
+          continue;
+        }
+
+        curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, config->ConnectTimeout());
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, reinterpret_cast<char *>(started));
+
+        if (!config->CaPath().empty())
+        {
+          curl_easy_setopt(curl, CURLOPT_CAINFO, config->CaPath().c_str());
+        }
+        else
+        {
+          curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+        }
+
+        HttpRequest::ApplyPath(curl, url, config, candidates[started]);
+
+        handles[started++] = curl;
+        curl_multi_add_handle(multi, curl);
+      }
+
+      int active = 0;
+      curl_multi_perform(multi, &active);
+
+      CURLMsg * msg = nullptr;
+      int left = 0;
+      while ((msg = curl_multi_info_read(multi, &left)) != nullptr)
+      {
+        if (msg->msg != CURLMSG_DONE)
+        {
+          continue;
+        }
+
+        ++finished;
+
+        if (msg->data.result == CURLE_OK)
+        {
+          char * index = nullptr;
+          curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &index);
+
+          if (connected.empty())
+          {
+            deadline = std::min(deadline, Now() + MULTIPATH_WINDOW_MS);
+          }
+
+          double seconds = 0;
+          curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME, &seconds);
+
+          connected.emplace_back(candidates[reinterpret_cast<size_t>(index)]);
+          rtts.emplace_back(static_cast<uint64_t>(seconds * 1000000));
+        }
+      }
+
+      if (finished < candidates.size())
+      {
+        curl_multi_wait(multi, nullptr, 0, 50, nullptr);
+      }
+    }
+
+    for (auto curl : handles)
+    {
+      if (curl)
+      {
+        curl_multi_remove_handle(multi, curl);
+        curl_easy_cleanup(curl);
+      }
+    }
+
+    curl_multi_cleanup(multi);
+
+    if (connected.empty())
+    {
+      printf("Error: none of the paths to %s could connect.\n", url.c_str());
+      return false;
+    }
+
+    if (config->Paths().Reset(connected, rtts))
+    {
+      std::string paths;
+      for (size_t i = 0; i < connected.size(); ++i)
+      {
+        char desc[BUFSIZ];
+        if (connected[i].IsDirect())
+        {
+          snprintf(desc, sizeof(desc), "%sdirect (%" PRIu64 " us)", i > 0 ? ", " : "", rtts[i]);
+        }
+        else
+        {
+          auto & endpoint = relays[connected[i].relay].endpoints[connected[i].endpoint];
+          snprintf(desc, sizeof(desc), "%srelay %s:%u (%" PRIu64 " us)", i > 0 ? ", " : "", endpoint.host.c_str(), endpoint.socksPort, rtts[i]);
+        }
+        paths += desc;
+      }
+
+      printf("Paths to %s: %s\n", url.c_str(), paths.c_str());
+    }
+
+    return true;
+  }
+}
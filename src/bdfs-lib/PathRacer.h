@@ -0,0 +1,111 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <json/json.h>
+#include "HttpConfig.h"
+
+namespace bdfs
+{
+  // Chooses the paths requests to a host take when it can be reached through
+  // relays. Instead of trying the direct url and the relay endpoints one by
+  // one, each with a full connect timeout, the candidates connect at the same
+  // time, STAGGER_MS apart in order of preference. The first one that connects
+  // wins, and those that connect within MULTIPATH_WINDOW_MS after it join it
+  // in the PathSet of the session. When the host reported its url reachable
+  // the relays only start after the direct path failed or timed out, and a
+  // direct path that connects is used alone. A background thread races the
+  // paths of a session once it is added, again when one of its requests fails
+  // to connect, and every REPROBE_INTERVAL_MS so that a better path is picked
+  // up once it becomes available.
+  class PathRacer
+  {
+  public:
+
+    static void Start();
+
+    static void Stop();
+
+    // Sessions without relays have a single path and are not raced
+    static void Add(const std::string & url, HttpConfig * config);
+
+    // Waits for a race of the config that is already running
+    static void Remove(HttpConfig * config);
+
+    // The current path of the config failed, race its paths soon
+    static void Invalidate(HttpConfig * config);
+
+    // {"host <name>": {...}} for the raced sessions, in the layout of the other stats
+    static Json::Value GetStats();
+
+  private:
+
+    struct Entry
+    {
+      std::string url;
+      uint64_t due = 0;
+      // End of the last race
+      uint64_t last = 0;
+    };
+
+    static const uint32_t MAX_CANDIDATES = 4;
+
+    static const uint32_t STAGGER_MS = 250;
+
+    static const uint32_t MULTIPATH_WINDOW_MS = 1000;
+
+    static const uint32_t REPROBE_INTERVAL_MS = 60000;
+
+    // A race that found no path is retried sooner, and failing requests
+    // do not start races closer together than this either
+    static const uint32_t RETRY_INTERVAL_MS = 5000;
+
+    static void RaceProc();
+
+    static bool Race(const std::string & url, HttpConfig * config);
+
+    static uint64_t Now();
+
+  private:
+
+    static std::mutex mutex;
+
+    static std::condition_variable cond;
+
+    static std::map<HttpConfig *, Entry> entries;
+
+    // Config raced right now, Remove waits for it
+    static HttpConfig * racing;
+
+    static std::thread racer;
+
+    static bool running;
+  };
+}
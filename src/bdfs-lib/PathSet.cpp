@@ -0,0 +1,196 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "PathSet.h"
+
+namespace bdfs
+{
+  PathSet::PathSet()
+  {
+    // Until a race says otherwise requests go to the host directly
+    this->entries.resize(1);
+  }
+
+
+  PathSet::Path PathSet::Pick(uint32_t * generation)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (generation)
+    {
+      *generation = this->generation;
+    }
+
+    if (this->entries.size() == 1)
+    {
+      return this->entries[0].path;
+    }
+
+    // Paths without samples yet weigh as much as the average of the others
+    double sampled = 0;
+    size_t count = 0;
+    for (const auto & entry : this->entries)
+    {
+      if (entry.throughput > 0)
+      {
+        sampled += entry.throughput;
+        ++count;
+      }
+    }
+
+    double fallback = count > 0 ? sampled / count : 1;
+
+    double total = 0;
+    Entry * best = nullptr;
+    for (auto & entry : this->entries)
+    {
+      double weight = entry.throughput > 0 ? entry.throughput : fallback;
+      entry.current += weight;
+      total += weight;
+
+      if (!best || entry.current > best->current)
+      {
+        best = &entry;
+      }
+    }
+
+    best->current -= total;
+    return best->path;
+  }
+
+
+  bool PathSet::Reset(const std::vector<Path> & paths, const std::vector<uint64_t> & rtts)
+  {
+    if (paths.empty())
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      const Path & path = paths[i];
+
+      Entry entry;
+      entry.path = path;
+      entry.rtt = i < rtts.size() ? rtts[i] : 0;
+
+      for (const auto & old : this->entries)
+      {
+        if (old.path == path)
+        {
+          entry.throughput = old.throughput;
+          break;
+        }
+      }
+
+      entries.emplace_back(entry);
+    }
+
+    bool changed = entries.size() != this->entries.size();
+    for (size_t i = 0; !changed && i < entries.size(); ++i)
+    {
+      changed = !(entries[i].path == this->entries[i].path);
+    }
+
+    this->entries.swap(entries);
+
+    if (changed)
+    {
+      ++this->generation;
+    }
+
+    return changed;
+  }
+
+
+  void PathSet::OnResult(const Path & path, uint64_t bytes, uint64_t micros)
+  {
+    if (bytes < MIN_SAMPLE_BYTES || micros == 0)
+    {
+      return;
+    }
+
+    double sample = 1000000.0 * bytes / micros;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    for (auto & entry : this->entries)
+    {
+      if (entry.path == path)
+      {
+        entry.throughput = entry.throughput > 0 ? entry.throughput + SMOOTHING * (sample - entry.throughput) : sample;
+        break;
+      }
+    }
+  }
+
+
+  void PathSet::OnFailure(const Path & path)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    if (this->entries.size() == 1)
+    {
+      return;
+    }
+
+    for (auto itr = this->entries.begin(); itr != this->entries.end(); ++itr)
+    {
+      if (itr->path == path)
+      {
+        this->entries.erase(itr);
+        ++this->generation;
+        break;
+      }
+    }
+  }
+
+
+  size_t PathSet::Size()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->entries.size();
+  }
+
+
+  Json::Value PathSet::GetStats()
+  {
+    Json::Value json;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    bool direct = false;
+    for (const auto & entry : this->entries)
+    {
+      direct = direct || entry.path.IsDirect();
+    }
+
+    json["gauges"]["paths"] = Json::Value::UInt(this->entries.size());
+    json["gauges"]["directPath"] = Json::Value::UInt(direct ? 1 : 0);
+    json["gauges"]["pathRttMicros"] = Json::Value::UInt(this->entries[0].rtt);
+
+    return json;
+  }
+}
@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <json/json.h>
+
+namespace bdfs
+{
+  // Paths over which the requests of a session reach its host. When a host
+  // can be reached over several relays at once, requests are spread across
+  // them by smooth weighted round robin, each path weighted by the throughput
+  // it delivered recently, so several relays add up their bandwidth. A path
+  // that fails to connect is dropped until the next race finds it again, and
+  // with a single path left every request simply takes that one.
+  class PathSet
+  {
+  public:
+
+    // Way requests reach the host: directly, or through an endpoint of a relay
+    struct Path
+    {
+      int relay = -1;
+      int endpoint = -1;
+
+      bool IsDirect() const { return relay < 0; }
+      bool operator==(const Path & other) const { return relay == other.relay && endpoint == other.endpoint; }
+    };
+
+    // Transfers smaller than this are dominated by latency and say little about throughput
+    static const uint64_t MIN_SAMPLE_BYTES = 64 * 1024;
+
+    PathSet();
+
+    PathSet(const PathSet &) = delete;
+    PathSet & operator=(const PathSet &) = delete;
+
+    // Path for the next request. The generation changes whenever the set
+    // does, so a request can tell whether it changed since it started.
+    Path Pick(uint32_t * generation = nullptr);
+
+    // Replaces the set with the paths that connected in a race, most
+    // preferred first, with the time each took to connect. The throughput of
+    // paths that stay is kept. Returns whether the paths changed.
+    bool Reset(const std::vector<Path> & paths, const std::vector<uint64_t> & rtts);
+
+    // A transfer over the path completed
+    void OnResult(const Path & path, uint64_t bytes, uint64_t micros);
+
+    // The path could not connect, the others take over its requests
+    void OnFailure(const Path & path);
+
+    size_t Size();
+
+    // Gauges of the set: its size, whether it goes direct and the connect time of the preferred path
+    Json::Value GetStats();
+
+  private:
+
+    struct Entry
+    {
+      Path path;
+      // Bytes per second, 0 until the first sample
+      double throughput = 0;
+      double current = 0;
+      // Connect time in the last race, in microseconds
+      uint64_t rtt = 0;
+    };
+
+    static constexpr double SMOOTHING = 0.2;
+
+    std::mutex mutex;
+
+    std::vector<Entry> entries;
+
+    uint32_t generation = 0;
+  };
+}
@@ -0,0 +1,71 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+namespace bdfs
+{
+  // Traffic classes of the client transport, most urgent first
+  enum class Priority
+  {
+    Foreground,
+    Flush,
+    Prefetch,
+    Rebuild
+  };
+
+  static const size_t PRIORITY_CLASSES = 4;
+
+  // Sets the class of the requests a thread issues for as long as the scope
+  // lives. Requests pick it up when they are created, so the lower layers do
+  // not need to pass it along. Threads start out in Foreground.
+  class PriorityScope
+  {
+  public:
+
+    explicit PriorityScope(Priority priority)
+      : previous(Current())
+    {
+      Current() = priority;
+    }
+
+    ~PriorityScope()
+    {
+      Current() = this->previous;
+    }
+
+    PriorityScope(const PriorityScope &) = delete;
+    PriorityScope & operator=(const PriorityScope &) = delete;
+
+    static Priority & Current()
+    {
+      static thread_local Priority current = Priority::Foreground;
+      return current;
+    }
+
+  private:
+
+    Priority previous;
+  };
+}
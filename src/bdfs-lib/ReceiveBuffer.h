@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <mutex>
+#include <memory>
+
+namespace bdfs
+{
+  // Caller owned destination of a response body, which the transfer writes
+  // into directly instead of collecting the body in a string first. A caller
+  // that stops waiting calls Detach before releasing the memory, after which
+  // every write fails and the transfer is aborted.
+  class ReceiveBuffer
+  {
+  public:
+
+    ReceiveBuffer(void * buf, size_t capacity)
+      : buf(static_cast<uint8_t *>(buf))
+      , capacity(capacity)
+    {
+    }
+
+    ReceiveBuffer(const ReceiveBuffer &) = delete;
+    ReceiveBuffer & operator=(const ReceiveBuffer &) = delete;
+
+    // Appends data, fails if it does not fit or the buffer is detached. The lock is only
+    // held for the copy, never while waiting on the network.
+    bool Write(const void * data, size_t len)
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (!this->buf || len > this->capacity - this->size)
+      {
+        return false;
+      }
+
+      memcpy(this->buf + this->size, data, len);
+      this->size += len;
+      return true;
+    }
+
+    // Discards what was written so far, for a transfer that starts over
+    void Rewind()
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->size = 0;
+    }
+
+    void Detach()
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->buf = nullptr;
+    }
+
+    size_t Size() const
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      return this->size;
+    }
+
+    size_t Capacity() const   { return this->capacity; }
+
+  private:
+
+    mutable std::mutex mutex;
+
+    uint8_t * buf;
+
+    size_t capacity;
+
+    size_t size = 0;
+  };
+
+
+  using ReceiveBufferPtr = std::shared_ptr<ReceiveBuffer>;
+}
@@ -0,0 +1,148 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+namespace bdfs
+{
+  // Request body that is sent straight from memory the caller owns, made of
+  // one or more segments that go out back to back. The caller keeps the
+  // segments alive until the request completes. A caller that stops waiting
+  // calls Detach before releasing the memory, after which the transfer is
+  // aborted instead of reading from it.
+  class SendBuffer
+  {
+  public:
+
+    SendBuffer() = default;
+
+    SendBuffer(const void * data, size_t size)
+    {
+      this->Append(data, size);
+    }
+
+    SendBuffer(const SendBuffer &) = delete;
+    SendBuffer & operator=(const SendBuffer &) = delete;
+
+    void Append(const void * data, size_t size)
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (size > 0)
+      {
+        this->segments.emplace_back(Segment{static_cast<const uint8_t *>(data), size});
+        this->size += size;
+      }
+    }
+
+    // Calls visit(ptr, len) for the pieces of [position, position + len) in
+    // order. Fails if the range is out of bounds, the buffer is detached or
+    // visit returns false.
+    template<typename F>
+    bool Visit(size_t position, size_t len, F && visit) const
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+
+      if (this->detached || position > this->size || len > this->size - position)
+      {
+        return false;
+      }
+
+      for (const auto & segment : this->segments)
+      {
+        if (len == 0)
+        {
+          break;
+        }
+
+        if (position >= segment.size)
+        {
+          position -= segment.size;
+          continue;
+        }
+
+        size_t count = std::min(segment.size - position, len);
+        if (!visit(segment.data + position, count))
+        {
+          return false;
+        }
+
+        position = 0;
+        len -= count;
+      }
+
+      return true;
+    }
+
+    // Copies [position, position + len) to dst
+    bool Read(size_t position, void * dst, size_t len) const
+    {
+      uint8_t * ptr = static_cast<uint8_t *>(dst);
+
+      return this->Visit(position, len, [&ptr](const uint8_t * data, size_t count)
+      {
+        memcpy(ptr, data, count);
+        ptr += count;
+        return true;
+      });
+    }
+
+    void Detach()
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->detached = true;
+    }
+
+    size_t Size() const
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      return this->size;
+    }
+
+  private:
+
+    struct Segment
+    {
+      const uint8_t * data;
+      size_t size;
+    };
+
+    mutable std::mutex mutex;
+
+    std::vector<Segment> segments;
+
+    size_t size = 0;
+
+    bool detached = false;
+  };
+
+
+  using SendBufferPtr = std::shared_ptr<SendBuffer>;
+}
@@ -0,0 +1,84 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "Stats.h"
+
+namespace bdfs
+{
+  void Histogram::Record(uint64_t micros)
+  {
+    size_t idx = 0;
+    while (idx < BUCKETS - 1 && (micros >> idx) != 0)
+    {
+      ++idx;
+    }
+
+    this->buckets[idx].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->sum.fetch_add(micros, std::memory_order_relaxed);
+  }
+
+
+  Json::Value Histogram::ToJson() const
+  {
+    Json::Value json;
+    json["count"] = Json::Value::UInt(this->count.load(std::memory_order_relaxed));
+    json["sum"] = Json::Value::UInt(this->sum.load(std::memory_order_relaxed));
+
+    Json::Value & values = json["buckets"] = Json::Value(Json::arrayValue);
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+      values.append(Json::Value::UInt(this->buckets[i].load(std::memory_order_relaxed)));
+    }
+
+    return json;
+  }
+
+
+  uint64_t Histogram::Percentile(const std::vector<uint64_t> & buckets, double quantile)
+  {
+    uint64_t total = 0;
+    for (auto val : buckets)
+    {
+      total += val;
+    }
+
+    if (total == 0)
+    {
+      return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(quantile * total);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+      seen += buckets[i];
+      if (seen > target || i + 1 == buckets.size())
+      {
+        return 1ull << i;
+      }
+    }
+
+    return 0;
+  }
+}
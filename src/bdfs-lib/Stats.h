@@ -0,0 +1,110 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <json/json.h>
+
+namespace bdfs
+{
+  // Monotonic counter that can be bumped from any thread without locking
+  class Counter
+  {
+  public:
+
+    void Add(uint64_t val = 1)  { this->value.fetch_add(val, std::memory_order_relaxed); }
+
+    uint64_t Get() const        { return this->value.load(std::memory_order_relaxed); }
+
+  private:
+
+    std::atomic<uint64_t> value{0};
+  };
+
+
+  // Lock free latency histogram with power of two buckets in microseconds. Bucket
+  // i counts samples below 2^i us, so the last bucket holds everything from 2^30 us.
+  class Histogram
+  {
+  public:
+
+    static const size_t BUCKETS = 32;
+
+    void Record(uint64_t micros);
+
+    uint64_t Count() const      { return this->count.load(std::memory_order_relaxed); }
+
+    // {"count": n, "sum": us, "buckets": [...]}, the buckets let readers compute
+    // percentiles over any window by subtracting two snapshots
+    Json::Value ToJson() const;
+
+    // Upper bound in microseconds of the bucket the given quantile (0 .. 1) falls in
+    static uint64_t Percentile(const std::vector<uint64_t> & buckets, double quantile);
+
+  private:
+
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+
+    std::atomic<uint64_t> count{0};
+
+    std::atomic<uint64_t> sum{0};
+  };
+
+
+  class StopWatch
+  {
+  public:
+
+    StopWatch() : start(std::chrono::steady_clock::now()) {}
+
+    uint64_t ElapsedMicros() const
+    {
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->start).count();
+    }
+
+  private:
+
+    std::chrono::steady_clock::time_point start;
+  };
+
+
+  // Records the lifetime of the scope into a histogram, including early returns
+  class ScopedLatency
+  {
+  public:
+
+    explicit ScopedLatency(Histogram & histogram) : histogram(histogram) {}
+
+    ~ScopedLatency()        { this->histogram.Record(this->watch.ElapsedMicros()); }
+
+  private:
+
+    Histogram & histogram;
+
+    StopWatch watch;
+  };
+}
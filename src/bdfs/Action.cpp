@@ -49,6 +49,7 @@ namespace dfs
         case Unmount: return "Unmount";
         case Show:  return "Show";
         case Format:  return "Format";
+        case Stats:   return "Stats";
       }
     }
 
@@ -64,6 +65,7 @@ namespace dfs
         else if (strcasecmp("Unmount", value) == 0) { return Unmount; }
         else if (strcasecmp("Show", value) == 0)    { return Show; }
         else if (strcasecmp("Format", value) == 0)    { return Format; }
+        else if (strcasecmp("Stats", value) == 0)   { return Stats; }
       }
       return Unknown;
     }
@@ -36,7 +36,8 @@ namespace dfs
       Mount,
       Unmount,
       Show,
-      Format
+      Format,
+      Stats
     };
 
     const char * ToString(T value);
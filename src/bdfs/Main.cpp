@@ -25,6 +25,9 @@
 #include <cmath>
 #include <limits>
 #include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
 #include <json/json.h>
 
 #include "BdTypes.h"
@@ -39,6 +42,7 @@
 #include "Buffer.h"
 #include "ContractRepository.h"
 #include "Cache.h"
+#include "Stats.h"
 
 #include "BdProtocol.h"
 #if defined(_WIN32)
@@ -215,6 +219,135 @@ void ListVolumes()
 }
 
 
+std::map<std::string, Json::Value> QueryStats(const std::string &name)
+{
+  std::vector<std::string> args;
+  if(!name.empty())
+  {
+    args.emplace_back(name);
+  }
+
+  auto resp = SendReceive(args, bdcp::QUERY_STATS);
+  auto respParams = bdcp::Parse(resp);
+
+  std::map<std::string, Json::Value> result;
+
+  Json::Reader reader;
+  for(size_t i = 0; i + 1 < respParams.size(); i += 2)
+  {
+    Json::Value json;
+    if(reader.parse(respParams[i + 1], json, false) && json.isObject())
+    {
+      result[respParams[i]] = json;
+    }
+  }
+
+  return result;
+}
+
+
+// Counters show the change since the previous sample when there is one, gauges always show the current value
+// and latency percentiles cover the same window as the counters
+void PrintStats(const std::string &name, const Json::Value &stats, const Json::Value *prev, uint32_t interval)
+{
+  printf("\n[%s]\n", name.c_str());
+
+  for(auto &component : stats.getMemberNames())
+  {
+    const Json::Value &cur = stats[component];
+    const Json::Value *old = prev ? &(*prev)[component] : nullptr;
+
+    for(auto &key : cur["counters"].getMemberNames())
+    {
+      uint64_t value = cur["counters"][key].asUInt();
+      std::string label = component + "." + key;
+
+      if(old)
+      {
+        uint64_t delta = value - (*old)["counters"][key].asUInt();
+        printf("  %-32s %14llu %12llu/s\n", label.c_str(), (long long unsigned)delta, (long long unsigned)(delta / interval));
+      }
+      else
+      {
+        printf("  %-32s %14llu\n", label.c_str(), (long long unsigned)value);
+      }
+    }
+
+    for(auto &key : cur["gauges"].getMemberNames())
+    {
+      std::string label = component + "." + key;
+      const Json::Value &gauge = cur["gauges"][key];
+      if(gauge.isDouble())
+      {
+        printf("  %-32s %14.2f\n", label.c_str(), gauge.asDouble());
+      }
+      else
+      {
+        printf("  %-32s %14llu\n", label.c_str(), (long long unsigned)gauge.asUInt());
+      }
+    }
+
+    for(auto &key : cur["latency"].getMemberNames())
+    {
+      const Json::Value &hist = cur["latency"][key];
+      std::vector<uint64_t> buckets(hist["buckets"].size());
+      for(Json::Value::ArrayIndex i = 0; i < hist["buckets"].size(); i++)
+      {
+        buckets[i] = hist["buckets"][i].asUInt();
+        if(old)
+        {
+          buckets[i] -= (*old)["latency"][key]["buckets"][i].asUInt();
+        }
+      }
+
+      uint64_t count = 0;
+      for(auto val : buckets)
+      {
+        count += val;
+      }
+
+      std::string label = component + "." + key + " (us)";
+      printf("  %-32s n=%-10llu p50<%-8llu p90<%-8llu p99<%-8llu max<%llu\n", label.c_str(),
+        (long long unsigned)count,
+        (long long unsigned)Histogram::Percentile(buckets, 0.5),
+        (long long unsigned)Histogram::Percentile(buckets, 0.9),
+        (long long unsigned)Histogram::Percentile(buckets, 0.99),
+        (long long unsigned)Histogram::Percentile(buckets, 1.0));
+    }
+  }
+}
+
+
+void ShowStats()
+{
+  auto stats = QueryStats(Options::Name);
+  if(stats.empty())
+  {
+    printf("No bound volume%s.\n", Options::Name.empty() ? "s" : (" named '" + Options::Name + "'").c_str());
+    return;
+  }
+
+  for(auto &it : stats)
+  {
+    PrintStats(it.first, it.second, nullptr, 1);
+  }
+
+  while(Options::Watch > 0)
+  {
+    std::this_thread::sleep_for(std::chrono::seconds(Options::Watch));
+
+    auto next = QueryStats(Options::Name);
+    for(auto &it : next)
+    {
+      auto old = stats.find(it.first);
+      PrintStats(it.first, it.second, old != stats.end() ? &old->second : nullptr, Options::Watch);
+    }
+
+    stats = std::move(next);
+  }
+}
+
+
 void HandleOptions()
 {
   std::vector<std::string> args;
@@ -362,7 +495,7 @@ void HandleOptions()
       else 
       {
         printf("Creating volume '%s'...\n",Options::Name.c_str());
-        VolumeManager::CreateVolume(Options::Name, Options::Size, Options::DataBlocks, Options::CodeBlocks);
+        VolumeManager::CreateVolume(Options::Name, Options::Size, Options::DataBlocks, Options::CodeBlocks, Options::Compress);
       }
       break;
     }
@@ -388,6 +521,12 @@ void HandleOptions()
       break;
     }
 
+    case Action::Stats:
+    {
+      ShowStats();
+      break;
+    }
+
     default:
       printf("Unhandled option : %s\n",Action::ToString(Options::Action));
   }
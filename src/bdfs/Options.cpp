@@ -26,6 +26,8 @@
 #include <fstream>
 #include <streambuf>
 #include <stdarg.h>
+#include <ctype.h>
+#include <algorithm>
 #include <json/json.h>
 #include <errno.h>
 #include "Paths.h"
@@ -36,10 +38,12 @@ namespace dfs
   std::string Options::Name;
   uint16_t Options::DataBlocks = 4;
   uint16_t Options::CodeBlocks = 4;
+  bool Options::Compress = false;
   uint64_t Options::Size =  1*1024*1024*1024; // 1GB
   std::vector<std::string> Options::KademliaUrl;
   std::vector<std::string> Options::Paths;
   std::vector<std::string> Options::ExternalArgs;
+  uint32_t Options::Watch = 0;
 
   extern void Exit(const char * format, ...);
 
@@ -56,7 +60,7 @@ namespace dfs
 
     printf("Usage: drive {action} [options] [files]\n");
     printf("\n");
-    printf("Actions: create,delete,mount,unmount,format,list\n");
+    printf("Actions: create,delete,mount,unmount,format,list,stats\n");
     printf("\n");
     printf("Options: create\n");
     printf("\n");
@@ -65,6 +69,7 @@ namespace dfs
     printf("  -k {url}       Kademlia server\n");
     printf("  -d {blocks}    Data blocks (1 .. 255)\n");
     printf("  -c {blocks}    Code blocks (1 .. 255)\n");
+    printf("  -z             Compress cells before encrypting them\n");
     printf("  -?|h           Show this help screen\n");
     printf("\n");
     printf("Options: delete\n");
@@ -100,6 +105,13 @@ namespace dfs
     printf("\n");
     printf("  -?|h           Show this help screen\n");
     printf("\n");
+    printf("Options: stats\n");
+    printf("eg: ./drive stats -n volume --watch 5\n");
+    printf("\n");
+    printf("  -n {name}      Volume name, all bound volumes if omitted\n");
+    printf("  --watch [sec]  Print the changes every few seconds (default 1)\n");
+    printf("  -?|h           Show this help screen\n");
+    printf("\n");
     exit(format == NULL ? 0 : 1);
   }
 
@@ -161,6 +173,11 @@ namespace dfs
       Options::DataBlocks = json["dataBlocks"].asUInt();
     }
 
+    if(json["compress"].isBool())
+    {
+      Options::Compress = json["compress"].asBool();
+    }
+
     if(json["size"].isIntegral())
     {
       Options::Size = json["size"].asUInt();
@@ -191,6 +208,14 @@ namespace dfs
           Options::ExternalArgs.push_back(argv[i]);
         }
       }
+      else if (strcmp(arg, "--watch") == 0)
+      {
+        Options::Watch = 1;
+        if (i + 1 < argc && isdigit(argv[i + 1][0]))
+        {
+          Options::Watch = std::max(atoi(argv[++i]), 1);
+        }
+      }
       else if (strcmp(arg, "-n") == 0)
       {
         Options::Name = argv[++i];
@@ -213,6 +238,10 @@ namespace dfs
         }
         Options::CodeBlocks = (uint16_t)val;
       }
+      else if (strcmp(arg, "-z") == 0)
+      {
+        Options::Compress = true;
+      }
       else if (strcmp(arg, "-s") == 0)
       {
         errno = 0;
@@ -36,10 +36,12 @@ namespace dfs
     static std::string Name;
     static uint16_t DataBlocks;
     static uint16_t CodeBlocks;
+    static bool Compress;
     static uint64_t Size;
     static std::vector<std::string> KademliaUrl;
     static std::vector<std::string> Paths;
     static std::vector<std::string> ExternalArgs;
+    static uint32_t Watch;
 
     static void Init(int argc, char ** argv);
     static void ReadConfig();
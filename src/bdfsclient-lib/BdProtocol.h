@@ -38,7 +38,8 @@ namespace bdfs
       BIND = 0,
       UNBIND,
       RESPONSE,
-      QUERY_VOLUMEINFO
+      QUERY_VOLUMEINFO,
+      QUERY_STATS
     };
 
     // paramCount = null terminated params after struct
@@ -24,23 +24,60 @@ SOFTWARE.
 #include <sys/stat.h>
 #if defined( _WIN32)
 #include <direct.h>
-#include "dirent-win.h"
 #else
 #include <unistd.h>
-#include <dirent.h>
 #endif
 #include <assert.h>
 #include <vector>
+#include <deque>
+#include <map>
 #include <chrono>
+#include <algorithm>
 #include <string.h>
 #include <inttypes.h>
 #include "Volume.h"
 #include "Buffer.h"
 #include "Cache.h"
 #include "Util.h"
+#include "Priority.h"
 
 namespace dfs
 {
+  // Granularity of dirty tracking within a cell
+  static const size_t SECTOR_SIZE = 4096;
+
+  // Percentage of the cache budget that may be dirty before the flusher
+  // stops waiting for the flush interval
+  static const uint64_t DIRTY_BACKGROUND_RATIO = 10;
+
+  // Percentage of the cache budget that may be dirty before writers get throttled
+  static const uint64_t DIRTY_RATIO = 20;
+
+  // Longest a single write is paused while the flusher catches up
+  static const uint32_t MAX_WRITE_PAUSE_MS = 100;
+
+  // Longest a writer waits past the hard limit. Cells of an unreachable host cannot be flushed and keep
+  // the dirty bytes up, the write then goes into the cache anyway instead of hanging the volume.
+  static const uint32_t MAX_WRITE_STALL_MS = 5000;
+
+  // How far past the requested sectors a read miss fetches within the same cell, kept well below
+  // a cell so that small reads still move little data
+  static const size_t READ_AHEAD = 16 * 1024;
+
+  // Limits of a single batched flush request to one partition
+  static const size_t MAX_FLUSH_BATCH = 32;
+  static const size_t MAX_FLUSH_BATCH_BYTES = 4 * 1024 * 1024;
+
+  // Size at which the journal is folded into the index even before the next interval
+  static const uint64_t MAX_JOURNAL_BYTES = 16 * 1024 * 1024;
+
+
+  static uint64_t countbits(const std::vector<bool> & bits)
+  {
+    return static_cast<uint64_t>(std::count(bits.begin(), bits.end(), true));
+  }
+
+
   static int mkpath(char* path)
   {
     char * p = path;
@@ -74,46 +111,81 @@ namespace dfs
   }
 
 
-  static void cleanpath(const char * folder)
+  static void packbits(const std::vector<bool> & bits, std::vector<uint8_t> & output)
   {
-    std::vector<std::string> names;
+    output.assign((bits.size() + 7) / 8, 0);
+    for (size_t i = 0; i < bits.size(); ++i)
+    {
+      if (bits[i])
+      {
+        output[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+      }
+    }
+  }
 
-    DIR * dir = opendir(folder);
-    if (!dir)
+
+  static void unpackbits(const std::vector<uint8_t> & input, std::vector<bool> & bits)
+  {
+    for (size_t i = 0; i < bits.size(); ++i)
     {
-      return;
+      bits[i] = (input[i / 8] & (1 << (i % 8))) != 0;
     }
+  }
+
+
+  static bool writecells(FILE * file, const std::map<uint64_t, std::vector<bool>> & cells)
+  {
+    std::vector<uint8_t> bits;
 
-    struct dirent * ent;
-    while ((ent = readdir(dir)) != nullptr)
+    for (const auto & cell : cells)
     {
-      if (ent->d_type == DT_REG && ent->d_name[0] != '.')
+      packbits(cell.second, bits);
+      if (fwrite(&cell.first, 1, sizeof(cell.first), file) != sizeof(cell.first) ||
+          fwrite(bits.data(), 1, bits.size(), file) != bits.size())
       {
-        names.emplace_back(ent->d_name);
+        return false;
       }
     }
 
-    closedir(dir);
+    return true;
+  }
+
 
-    for (const auto & name : names)
+  static bool readcells(FILE * file, uint64_t count, size_t sectorCount, std::map<uint64_t, std::vector<bool>> & cells)
+  {
+    std::vector<uint8_t> bits((sectorCount + 7) / 8);
+
+    for (uint64_t i = 0; i < count; ++i)
     {
-      char path[PATH_MAX];
-      sprintf(path, "%s/%s", folder, name.c_str());
+      uint64_t column = 0;
+      if (fread(&column, 1, sizeof(column), file) != sizeof(column) ||
+          fread(bits.data(), 1, bits.size(), file) != bits.size())
+      {
+        return false;
+      }
 
-      //      unlink(path);
+      auto & sectors = cells[column];
+      sectors.resize(sectorCount);
+      unpackbits(bits, sectors);
     }
+
+    return true;
   }
 
 
-  Cache::Cache(std::string root, Volume * volume, size_t limit, uint32_t flushPolicy)
+  Cache::Cache(std::string root, Volume * volume, uint64_t limit, uint32_t flushPolicy, size_t flushConcurrency, std::unique_ptr<CacheStore> store)
     : rootPath(std::move(root))
     , limit(limit)
     , flushPolicy(flushPolicy)
+    , flushConcurrency(flushConcurrency > 0 ? flushConcurrency : 1)
     , volume(volume)
     , active(true)
   {
     assert(volume);
 
+    this->sectorSize = std::min(SECTOR_SIZE, this->volume->BlockSize());
+    this->sectorCount = (this->volume->BlockSize() + this->sectorSize - 1) / this->sectorSize;
+
     if (rootPath.empty())
     {
       rootPath = "cache";
@@ -126,7 +198,12 @@ namespace dfs
 
     mkpath(const_cast<char *>(rootPath.c_str()));
 
-    cleanpath(rootPath.c_str());
+    this->store = store ? std::move(store) : std::make_unique<FileCacheStore>(rootPath, this->volume->BlockSize());
+    this->SetBudget(limit);
+
+    // Rebuild the index of the previous run and compact it with its journal
+    this->LoadIndex();
+    this->SaveIndex();
 
     this->thread = std::thread(std::bind(&Cache::ThreadProc, this));
   }
@@ -134,6 +211,8 @@ namespace dfs
 
   Cache::~Cache()
   {
+    CacheBudget::Unregister(this);
+
     if (this->active)
     {
       this->active = false;
@@ -151,7 +230,13 @@ namespace dfs
     }
 
     this->Flush(true);
-    cleanpath(this->rootPath.c_str());
+    this->SaveIndex();
+
+    if (this->journal)
+    {
+      fclose(this->journal);
+      this->journal = nullptr;
+    }
   }
 
 
@@ -165,6 +250,8 @@ namespace dfs
       return false;
     }
 
+    bdfs::ScopedLatency latency(this->stats.readLatency);
+
     ReadRequest req{ row, column, buffer, size, offset };
 
     if (!this->requests.Produce(&req))
@@ -197,6 +284,10 @@ namespace dfs
       return false;
     }
 
+    bdfs::ScopedLatency latency(this->stats.writeLatency);
+
+    this->Throttle();
+
     WriteRequest req{ row, column, buffer, size, offset };
 
     if (!this->requests.Produce(&req))
@@ -219,9 +310,119 @@ namespace dfs
   }
 
 
+  void Cache::SetBudget(uint64_t bytes)
+  {
+    uint64_t capacity = this->store->Capacity();
+
+    // Picked up by the cache thread on its next access
+    this->limit = capacity > 0 ? std::min(bytes, capacity) : bytes;
+  }
+
+
+  uint64_t Cache::TakeGhostHits()
+  {
+    return this->ghostHits.exchange(0);
+  }
+
+
+  void Cache::GetDirtyLimits(uint64_t & background, uint64_t & foreground) const
+  {
+    // Always allow at least a full row to be dirty so that small budgets do not serialize writes
+    uint64_t row = this->volume->BlockSize() * (this->volume->DataCount() + this->volume->CodeCount());
+    uint64_t limit = this->limit;
+
+    background = std::max(limit * DIRTY_BACKGROUND_RATIO / 100, row);
+    foreground = std::max(limit * DIRTY_RATIO / 100, background + row);
+  }
+
+
+  void Cache::Throttle()
+  {
+    uint64_t background = 0;
+    uint64_t foreground = 0;
+    this->GetDirtyLimits(background, foreground);
+
+    uint64_t dirty = this->dirtyBytes;
+    if (dirty <= foreground)
+    {
+      return;
+    }
+
+    this->stats.throttledWrites.Add();
+    bdfs::ScopedLatency delay(this->stats.throttleDelay);
+
+    {
+      // Make sure the flusher is running
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->hasNotification = true;
+      this->cond.notify_one();
+    }
+
+    // The pause grows with the overshoot so writers slow down gradually instead of stalling at a
+    // hard limit. Past twice the high watermark they wait until the flusher has caught up.
+    uint64_t range = foreground - background;
+    uint64_t hard = foreground + range;
+
+    if (dirty < hard)
+    {
+      uint64_t pause = MAX_WRITE_PAUSE_MS * (dirty - foreground) / range;
+      std::this_thread::sleep_for(std::chrono::milliseconds(pause));
+      return;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_WRITE_STALL_MS);
+
+    while (this->active && this->dirtyBytes >= hard)
+    {
+      if (std::chrono::steady_clock::now() >= deadline)
+      {
+        this->stats.stalledWrites.Add();
+        return;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(MAX_WRITE_PAUSE_MS));
+    }
+  }
+
+
+  Json::Value Cache::GetStats() const
+  {
+    Json::Value json;
+
+    Json::Value & counters = json["counters"];
+    counters["readHits"] = Json::Value::UInt(this->stats.readHits.Get());
+    counters["readMisses"] = Json::Value::UInt(this->stats.readMisses.Get());
+    counters["fetchedBytes"] = Json::Value::UInt(this->stats.fetchedBytes.Get());
+    counters["writes"] = Json::Value::UInt(this->stats.writes.Get());
+    counters["unchangedWrites"] = Json::Value::UInt(this->stats.unchangedWrites.Get());
+    counters["throttledWrites"] = Json::Value::UInt(this->stats.throttledWrites.Get());
+    counters["stalledWrites"] = Json::Value::UInt(this->stats.stalledWrites.Get());
+    counters["evictions"] = Json::Value::UInt(this->stats.evictions.Get());
+    counters["flushedCells"] = Json::Value::UInt(this->stats.flushedCells.Get());
+    counters["flushedBytes"] = Json::Value::UInt(this->stats.flushedBytes.Get());
+    counters["flushErrors"] = Json::Value::UInt(this->stats.flushErrors.Get());
+
+    Json::Value & gauges = json["gauges"];
+    gauges["usedBytes"] = Json::Value::UInt(this->usage.load());
+    gauges["limitBytes"] = Json::Value::UInt(this->limit.load());
+    gauges["dirtyBytes"] = Json::Value::UInt(this->dirtyBytes.load());
+
+    Json::Value & latency = json["latency"];
+    latency["read"] = this->stats.readLatency.ToJson();
+    latency["write"] = this->stats.writeLatency.ToJson();
+    latency["fetch"] = this->stats.fetchLatency.ToJson();
+    latency["flush"] = this->stats.flushLatency.ToJson();
+    latency["throttle"] = this->stats.throttleDelay.ToJson();
+
+    return json;
+  }
+
+
   void Cache::ThreadProc()
   {
-    uint64_t ts = static_cast<uint64_t>(time(nullptr));
+    // Replay dirty cells recovered from the previous run right away
+    uint64_t ts = this->dirtyBytes > 0 ? 0 : static_cast<uint64_t>(time(nullptr));
+    uint64_t saved = static_cast<uint64_t>(time(nullptr));
 
     while (this->active)
     {
@@ -249,7 +450,38 @@ namespace dfs
 
       uint64_t now = static_cast<uint64_t>(time(nullptr));
 
-      if (now - ts < this->flushPolicy)
+      // Saving the index truncates the journal. A cache that stays over the background watermark never
+      // takes the interval flush below, so this cannot wait for it.
+      if (now - saved >= this->flushPolicy || this->journalBytes >= MAX_JOURNAL_BYTES)
+      {
+        this->SaveIndex();
+        saved = now;
+      }
+
+      uint64_t background = 0;
+      uint64_t foreground = 0;
+      this->GetDirtyLimits(background, foreground);
+
+      if (this->dirtyBytes > background)
+      {
+        // Flush the oldest cells without waiting for the interval until we are back under the watermark
+        uint64_t dirty = this->dirtyBytes;
+
+        this->Flush(false);
+
+        if (this->dirtyBytes >= dirty && this->requests.Size() == 0)
+        {
+          // No progress, most likely the hosts are unreachable. Do not spin.
+          std::unique_lock<std::mutex> lock(this->mutex);
+          if (!this->hasNotification)
+          {
+            this->cond.wait_for(lock, std::chrono::seconds(1));
+          }
+
+          this->hasNotification = false;
+        }
+      }
+      else if (now - ts < this->flushPolicy)
       {
         std::unique_lock<std::mutex> lock(this->mutex);
         if (!this->hasNotification)
@@ -284,68 +516,229 @@ namespace dfs
       buf = new uint8_t[this->volume->BlockSize()];
     }
 
-    char filename[PATH_MAX];
-    sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), row);
+    std::vector<bool> valid;
+    this->LoadCell(row, column, buf, valid);
 
-    bool success = this->ReadFileBlock(filename, column, buf);
+    size_t first = offset / this->sectorSize;
+    size_t last = (offset + size + this->sectorSize - 1) / this->sectorSize;
 
-    if (!success)
+    if (std::find(valid.begin() + first, valid.begin() + last, false) == valid.begin() + last)
     {
-      success = this->volume->__ReadDirect(row, column, buf, this->volume->BlockSize(), 0);
-      if (success)
-      {
-        // Do not fail if write cache fails since we are just reading data
-        this->WriteFileBlock(filename, column, buf);
-      }
+      this->stats.readHits.Add();
+    }
+    else
+    {
+      this->stats.readMisses.Add();
     }
 
+    // Readers of compressed cells ask for exactly the prefix that holds the payload, anything past it is waste
+    size_t ahead = this->volume->IsCompressed() ? 0 : READ_AHEAD / this->sectorSize;
+
+    bool success = this->FillCell(row, column, buf, valid, first, last, ahead);
+
     if (buf != buffer)
     {
       memcpy(buffer, buf + offset, size);
       delete[] buf;
     }
 
-    this->UpdateTimestamp(row, false);
+    this->UpdateTimestamp(row);
 
     return success;
   }
 
 
-  bool Cache::WriteImpl(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
+  bool Cache::LoadCell(uint64_t row, uint64_t column, uint8_t * cell, std::vector<bool> & valid)
   {
-    uint8_t * buf = nullptr;
-    if (size == this->volume->BlockSize() && offset == 0)
+    auto itr = this->items.find(row);
+
+    if (!this->store->Read(row, column, cell))
     {
-      buf = const_cast<uint8_t *>(static_cast<const uint8_t *>(buffer));
+      if (itr == this->items.end() && this->ghosts.Take(row))
+      {
+        ++this->ghostHits;
+      }
+
+      memset(cell, 0, this->volume->BlockSize());
+      valid.assign(this->sectorCount, false);
+      return false;
     }
-    else
+
+    // Cells without a validity map are complete
+    valid.assign(this->sectorCount, true);
+
+    if (itr != this->items.end())
     {
-      buf = new uint8_t[this->volume->BlockSize()];
-      if (!this->ReadImpl(row, column, buf, this->volume->BlockSize(), 0))
+      auto partial = itr->second.valid.find(column);
+      if (partial != itr->second.valid.end())
+      {
+        valid = partial->second;
+      }
+    }
+
+    return true;
+  }
+
+
+  bool Cache::FillCell(uint64_t row, uint64_t column, uint8_t * cell, std::vector<bool> & valid, size_t first, size_t last, size_t ahead)
+  {
+    const size_t blockSize = this->volume->BlockSize();
+
+    while (first < last && valid[first])
+    {
+      ++first;
+    }
+
+    while (last > first && valid[last - 1])
+    {
+      --last;
+    }
+
+    if (first == last)
+    {
+      return true;
+    }
+
+    // Read ahead within the cell, sectors that are already valid in between are simply skipped below
+    last = std::min(this->sectorCount, last + ahead);
+
+    size_t offset = first * this->sectorSize;
+    size_t size = std::min(last * this->sectorSize, blockSize) - offset;
+
+    std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+
+    {
+      bdfs::ScopedLatency latency(this->stats.fetchLatency);
+      if (!this->volume->__ReadDirect(row, column, data.get(), size, offset))
       {
-        delete[] buf;
         return false;
       }
+    }
 
-      memcpy(buf + offset, buffer, size);
+    this->stats.fetchedBytes.Add(size);
+
+    bool wasCached = std::find(valid.begin(), valid.end(), true) != valid.end();
+
+    // Never overwrite valid sectors, they might hold dirty data
+    for (size_t idx = first; idx < last; ++idx)
+    {
+      if (!valid[idx])
+      {
+        size_t start = idx * this->sectorSize;
+        memcpy(cell + start, data.get() + (start - offset), std::min(this->sectorSize, blockSize - start));
+        valid[idx] = true;
+      }
     }
 
-    char filename[PATH_MAX];
-    sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), row);
+    if (!wasCached)
+    {
+      // The cell is about to appear in the row file, make sure a crash cannot leave it looking complete
+      this->SetValid(row, column, std::vector<bool>(this->sectorCount, false));
+    }
 
-    bool success = this->WriteFileBlock(filename, column, buf);
+    // Do not fail if write cache fails since we are just reading data
+    if (this->StoreCell(row, column, cell))
+    {
+      this->SetValid(row, column, valid);
+    }
 
-    if (buf != buffer)
+    return true;
+  }
+
+
+  void Cache::SetValid(uint64_t row, uint64_t column, const std::vector<bool> & valid)
+  {
+    Item & item = this->items[row];
+
+    if (std::find(valid.begin(), valid.end(), false) == valid.end())
     {
-      delete[] buf;
+      if (item.valid.erase(column) == 0)
+      {
+        // Was complete before already
+        return;
+      }
+    }
+    else
+    {
+      item.valid[column] = valid;
     }
 
-    if (success)
+    this->WriteJournal(JournalType::Valid, row, column, &valid);
+  }
+
+
+  bool Cache::WriteImpl(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
+  {
+    const size_t blockSize = this->volume->BlockSize();
+
+    std::unique_ptr<uint8_t[]> cell(new uint8_t[blockSize]);
+
+    std::vector<bool> valid;
+    bool cached = this->LoadCell(row, column, cell.get(), valid);
+
+    // Only sectors the write covers partially need their old content
+    size_t first = offset / this->sectorSize;
+    size_t last = (offset + size + this->sectorSize - 1) / this->sectorSize;
+
+    if (offset % this->sectorSize != 0 && !this->FillCell(row, column, cell.get(), valid, first, first + 1))
     {
-      this->UpdateTimestamp(row, true);
+      return false;
     }
 
-    return success;
+    if ((offset + size) % this->sectorSize != 0 && offset + size < blockSize &&
+        !this->FillCell(row, column, cell.get(), valid, last - 1, last))
+    {
+      return false;
+    }
+
+    // Only the sectors whose content actually changes need to reach the host later
+    std::vector<bool> sectors(this->sectorCount, false);
+    bool changed = false;
+
+    const uint8_t * src = static_cast<const uint8_t *>(buffer);
+    for (size_t idx = first; idx < last; ++idx)
+    {
+      size_t start = std::max(idx * this->sectorSize, offset);
+      size_t end = std::min((idx + 1) * this->sectorSize, offset + size);
+
+      if (!valid[idx] || memcmp(cell.get() + start, src + (start - offset), end - start) != 0)
+      {
+        sectors[idx] = true;
+        changed = true;
+      }
+
+      valid[idx] = true;
+    }
+
+    this->stats.writes.Add();
+
+    if (!changed)
+    {
+      this->stats.unchangedWrites.Add();
+      this->UpdateTimestamp(row);
+      return true;
+    }
+
+    memcpy(cell.get() + offset, buffer, size);
+
+    // Journal first so that a crash never loses track of data that only lives here
+    this->WriteJournal(JournalType::Dirty, row, column, &sectors);
+
+    if (!cached)
+    {
+      this->SetValid(row, column, std::vector<bool>(this->sectorCount, false));
+    }
+
+    if (!this->StoreCell(row, column, cell.get()))
+    {
+      return false;
+    }
+
+    this->SetValid(row, column, valid);
+    this->SetDirty(row, column, sectors);
+    this->UpdateTimestamp(row);
+
+    return true;
   }
 
 
@@ -353,8 +746,6 @@ namespace dfs
   {
     size_t size = this->items.size();
 
-    bool flushed = false;
-
     auto ts = this->timestamps.begin();
 
     while (ts != this->timestamps.end() && size == this->items.size())
@@ -362,18 +753,18 @@ namespace dfs
       auto it = this->items.find(ts->second);
       if (it != this->items.end())
       {
-        if (it->second.dirty && !flushed)
+        // Dirty rows stay until the flusher has written them back
+        if (it->second.dirty.empty())
         {
-          this->Flush(false);
-        }
-
-        if (!it->second.dirty)
-        {
-          char filename[PATH_MAX];
-          sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), ts->second);
-          unlink(filename);
+          this->store->Remove(ts->second);
 
+          this->usage -= std::min<uint64_t>(this->usage, it->second.bytes);
+          this->stats.evictions.Add();
           this->items.erase(it);
+
+          // Remember about as many evicted rows as are cached
+          this->ghosts.SetCapacity(std::max<size_t>(this->items.size(), 16));
+          this->ghosts.Add(ts->second);
         }
         else
         {
@@ -389,181 +780,509 @@ namespace dfs
 
   bool Cache::Flush(bool force)
   {
+    // Write back yields to the reads of the callers
+    bdfs::PriorityScope scope(bdfs::Priority::Flush);
+
+    // Dirty ranges of the same partition go out together in one request
+    struct FlushOp
+    {
+      uint64_t column;
+      size_t size = 0;
+      std::vector<uint64_t> rows;
+      std::vector<bdfs::BlockExtent> extents;
+      // The dirty ranges are sent straight from the cells they were loaded into
+      std::vector<bdfs::Buffer> cells;
+      bdfs::SendBufferPtr body = std::make_shared<bdfs::SendBuffer>();
+      bdfs::AsyncResultPtr<ssize_t> result;
+      bdfs::StopWatch watch;
+    };
+
     bool all = true;
 
-    bdfs::Buffer buf;
+    uint64_t now = static_cast<uint64_t>(time(nullptr));
+    uint64_t expire = now > this->flushPolicy ? now - this->flushPolicy : 0;
+
+    uint64_t background = 0;
+    uint64_t foreground = 0;
+    this->GetDirtyLimits(background, foreground);
 
-    uint64_t expire = static_cast<uint64_t>(time(nullptr)) + this->flushPolicy;
+    // Above the low watermark the oldest cells go out regardless of their age
+    uint64_t excess = this->dirtyBytes > background ? this->dirtyBytes - background : 0;
 
-    for (auto ts = this->timestamps.begin(); ts != this->timestamps.end(); ++ts)
+    std::multimap<uint64_t, uint64_t> rows;
+    for (const auto & item : this->items)
     {
-      if (!force && ts->first > expire)
+      if (!item.second.dirty.empty())
       {
-        // Not expired yet
-        break;
+        rows.emplace(item.second.dirtied, item.first);
       }
+    }
 
-      auto itr = this->items.find(ts->second);
-      if (itr == this->items.end() || !itr->second.dirty)
+    // Collect the dirty cells first since completing a flush modifies the dirty maps
+    std::vector<std::pair<uint64_t, uint64_t>> cells;
+
+    for (const auto & entry : rows)
+    {
+      if (!force && entry.first > expire && excess == 0)
       {
-        continue;
+        // Not expired yet
+        break;
       }
 
-      char filename[PATH_MAX];
-      sprintf(filename, "%s/%" PRIu64 "", this->rootPath.c_str(), itr->first);
-
-      FILE * file = fopen(filename, "rb");
-      if (file)
+      for (const auto & cell : this->items[entry.second].dirty)
       {
-        bool success = true;
+        cells.emplace_back(entry.second, cell.first);
 
-        uint64_t column = 0;
-        while (fread(&column, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
-        {
-          buf.Resize(this->volume->BlockSize());
+        uint64_t bytes = countbits(cell.second) * this->sectorSize;
+        excess -= std::min(excess, bytes);
+      }
+    }
 
-          if (fread(buf.Buf(), 1, this->volume->BlockSize(), file) != this->volume->BlockSize() ||
-            !this->volume->__WriteDirect(itr->first, column, buf.Buf(), this->volume->BlockSize(), 0))
-          {
-            success = false;
-            break;
-          }
-        }
+    std::deque<FlushOp> pending;
+    std::map<uint64_t, FlushOp> batches;
+
+    auto complete = [this, &all](FlushOp & op)
+    {
+      bool success = this->volume->__WaitDirect(op.column, op.result, op.size);
+      this->stats.flushLatency.Record(op.watch.ElapsedMicros());
 
-        fclose(file);
+      // The cells are released with the op even if the write is still in flight
+      op.body->Detach();
 
+      for (uint64_t row : op.rows)
+      {
         if (success)
         {
-          itr->second.dirty = false;
+          this->stats.flushedCells.Add();
+          this->ClearDirty(row, op.column);
+          this->WriteJournal(JournalType::Clean, row, op.column, nullptr);
         }
         else
         {
-          printf("Error: failed to flush the cache block: row=%llu column=%llu\n", (long long unsigned)itr->first, (long long unsigned)column);
-          all = false;
+          printf("Error: failed to flush the cache block: row=%llu column=%llu\n", (long long unsigned)row, (long long unsigned)op.column);
         }
       }
 
-      if (this->requests.Size() > 0)
+      if (success)
+      {
+        this->stats.flushedBytes.Add(op.size);
+      }
+      else
+      {
+        this->stats.flushErrors.Add();
+        all = false;
+      }
+    };
+
+    auto issue = [this, &pending, &complete](FlushOp && op)
+    {
+      op.watch = bdfs::StopWatch();
+      op.result = this->volume->__WriteDirectBatchAsync(op.column, op.extents, op.body);
+      pending.emplace_back(std::move(op));
+
+      // Bound the number of outstanding writes
+      while (pending.size() >= this->flushConcurrency)
+      {
+        complete(pending.front());
+        pending.pop_front();
+      }
+    };
+
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+      if (this->requests.Size() > 0 && this->dirtyBytes <= foreground)
       {
-        // We should respond to pending requests first
-        all = (++ts == this->timestamps.end());
+        // We should respond to pending requests first unless writers are already being throttled
+        all = false;
         break;
       }
+
+      uint64_t row = cells[i].first;
+      uint64_t column = cells[i].second;
+
+      const auto & sectors = this->items[row].dirty[column];
+
+      size_t first = 0;
+      while (first < sectors.size() && !sectors[first])
+      {
+        ++first;
+      }
+
+      size_t last = sectors.size();
+      while (last > first && !sectors[last - 1])
+      {
+        --last;
+      }
+
+      if (first == last)
+      {
+        this->ClearDirty(row, column);
+        this->WriteJournal(JournalType::Clean, row, column, nullptr);
+        continue;
+      }
+
+      size_t offset = first * this->sectorSize;
+      size_t size = std::min(last * this->sectorSize, this->volume->BlockSize()) - offset;
+
+      bdfs::Buffer cell;
+      cell.Resize(this->volume->BlockSize());
+
+      // The range goes out in one piece, so sectors in between that were never fetched have to be filled first
+      std::vector<bool> valid;
+      if (!this->LoadCell(row, column, static_cast<uint8_t *>(cell.Buf()), valid) ||
+          !this->FillCell(row, column, static_cast<uint8_t *>(cell.Buf()), valid, first, last))
+      {
+        printf("Error: failed to read the cache block: row=%llu column=%llu\n", (long long unsigned)row, (long long unsigned)column);
+        all = false;
+        continue;
+      }
+
+      FlushOp & op = batches[column];
+      op.column = column;
+      op.rows.emplace_back(row);
+      op.extents.emplace_back(bdfs::BlockExtent{row, static_cast<uint32_t>(offset), static_cast<uint32_t>(size)});
+
+      op.body->Append(static_cast<uint8_t *>(cell.Buf()) + offset, size);
+      op.cells.emplace_back(std::move(cell));
+      op.size += size;
+
+      if (op.extents.size() >= MAX_FLUSH_BATCH || op.size >= MAX_FLUSH_BATCH_BYTES)
+      {
+        issue(std::move(op));
+        batches.erase(column);
+      }
+    }
+
+    for (auto & batch : batches)
+    {
+      issue(std::move(batch.second));
+    }
+
+    while (!pending.empty())
+    {
+      complete(pending.front());
+      pending.pop_front();
     }
 
     return all;
   }
 
 
-  bool Cache::ReadFileBlock(const char * filename, uint64_t column, void * buffer)
+  bool Cache::StoreCell(uint64_t row, uint64_t column, const void * cell)
   {
-    size_t bytes = 0;
+    uint64_t rowBytes = 0;
+    bool success = this->store->Write(row, column, cell, rowBytes);
 
-    FILE * file = fopen(filename, "rb");
-    if (file)
+    if (!success && this->store->Capacity() > 0)
     {
-      uint64_t idx = 0;
+      // The store itself is full, make room regardless of the budget and try once more
+      this->Pop();
+      success = this->store->Write(row, column, cell, rowBytes);
+    }
 
-      while (fread(&idx, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
+    if (success)
+    {
+      this->SetRowBytes(row, rowBytes);
+    }
+
+    return success;
+  }
+
+
+  void Cache::UpdateTimestamp(uint64_t row)
+  {
+    uint64_t now = static_cast<uint64_t>(time(nullptr));
+
+    auto itr = this->items.find(row);
+    if (itr != this->items.end())
+    {
+      auto range = this->timestamps.equal_range(itr->second.timestamp);
+      for (auto it = range.first; it != range.second; ++it)
       {
-        if (idx == column)
+        if (it->second == row)
         {
-          bytes = fread(buffer, 1, this->volume->BlockSize(), file);
+          this->timestamps.erase(it);
           break;
         }
-        else
-        {
-          fseek(file, static_cast<long>(this->volume->BlockSize()), SEEK_CUR);
-        }
       }
 
-      fclose(file);
+      itr->second.timestamp = now;
+    }
+    else
+    {
+      this->items[row].timestamp = now;
     }
 
-    return bytes == this->volume->BlockSize();
+    this->timestamps.emplace(now, row);
+
+    while (this->usage > this->limit)
+    {
+      size_t size = this->items.size();
+
+      this->Pop();
+
+      if (this->items.size() == size)
+      {
+        // Everything left is dirty
+        break;
+      }
+    }
   }
 
 
-  bool Cache::WriteFileBlock(const char * filename, uint64_t column, const void * buffer)
+  void Cache::SetRowBytes(uint64_t row, uint64_t bytes)
   {
-    size_t bytes = 0;
+    Item & item = this->items[row];
 
-    FILE * file = fopen(filename, "rb+");
-    if (!file)
+    this->usage = this->usage - std::min<uint64_t>(this->usage, item.bytes) + bytes;
+    item.bytes = bytes;
+  }
+
+
+  void Cache::SetDirty(uint64_t row, uint64_t column, const std::vector<bool> & sectors)
+  {
+    Item & item = this->items[row];
+    if (item.dirty.empty())
     {
-      file = fopen(filename, "wb+");
+      item.dirtied = static_cast<uint64_t>(time(nullptr));
     }
 
-    if (file)
-    {
-      uint64_t idx = 0;
+    auto & dirty = item.dirty[column];
+    uint64_t before = countbits(dirty);
 
-      while (fread(&idx, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
+    if (dirty.empty())
+    {
+      dirty = sectors;
+    }
+    else
+    {
+      for (size_t i = 0; i < sectors.size() && i < dirty.size(); ++i)
       {
-        if (idx == column)
+        if (sectors[i])
         {
-          fseek(file, 0, SEEK_CUR);
-          bytes = fwrite(buffer, 1, this->volume->BlockSize(), file);
-          break;
+          dirty[i] = true;
         }
-        else
+      }
+    }
+
+    this->dirtyBytes += (countbits(dirty) - before) * this->sectorSize;
+  }
+
+
+  void Cache::ClearDirty(uint64_t row, uint64_t column)
+  {
+    auto itr = this->items.find(row);
+    if (itr == this->items.end())
+    {
+      return;
+    }
+
+    auto cell = itr->second.dirty.find(column);
+    if (cell != itr->second.dirty.end())
+    {
+      uint64_t bytes = countbits(cell->second) * this->sectorSize;
+      this->dirtyBytes -= std::min<uint64_t>(this->dirtyBytes, bytes);
+
+      itr->second.dirty.erase(cell);
+    }
+  }
+
+
+  bool Cache::LoadIndex()
+  {
+    const uint64_t blockSize = this->volume->BlockSize();
+
+    std::string indexPath = this->rootPath + "/index";
+    std::string journalPath = this->rootPath + "/journal";
+
+    FILE * file = fopen(indexPath.c_str(), "rb");
+    if (file)
+    {
+      IndexHeader header;
+      if (fread(&header, 1, sizeof(header), file) == sizeof(header) &&
+          header.magic == INDEX_MAGIC &&
+          header.version == INDEX_VERSION &&
+          header.blockSize == blockSize &&
+          header.sectorCount == this->sectorCount)
+      {
+        for (uint64_t i = 0; i < header.count; ++i)
         {
-          fseek(file, static_cast<long>(this->volume->BlockSize()), SEEK_CUR);
+          uint64_t entry[4];
+          if (fread(entry, 1, sizeof(entry), file) != sizeof(entry))
+          {
+            break;
+          }
+
+          Item & item = this->items[entry[0]];
+          item.timestamp = entry[1];
+
+          if (!readcells(file, entry[2], this->sectorCount, item.dirty) ||
+              !readcells(file, entry[3], this->sectorCount, item.valid))
+          {
+            break;
+          }
         }
       }
 
-      if (bytes != this->volume->BlockSize())
+      fclose(file);
+    }
+
+    // Replay the changes recorded since the index was last saved
+    file = fopen(journalPath.c_str(), "rb");
+    if (file)
+    {
+      std::vector<uint8_t> bits((this->sectorCount + 7) / 8);
+      std::vector<bool> sectors(this->sectorCount);
+
+      JournalRecord record;
+      while (fread(&record, 1, sizeof(record), file) == sizeof(record) &&
+             fread(bits.data(), 1, bits.size(), file) == bits.size())
       {
-        fseek(file, 0, SEEK_CUR);
-        if (fwrite(&column, 1, sizeof(column), file) == sizeof(column))
+        switch (record.type)
         {
-          bytes = fwrite(buffer, 1, this->volume->BlockSize(), file);
+        case JournalType::Dirty:
+          unpackbits(bits, sectors);
+          this->SetDirty(record.row, record.column, sectors);
+          break;
+
+        case JournalType::Clean:
+          this->ClearDirty(record.row, record.column);
+          break;
+
+        case JournalType::Valid:
+          unpackbits(bits, sectors);
+          if (std::find(sectors.begin(), sectors.end(), false) == sectors.end())
+          {
+            this->items[record.row].valid.erase(record.column);
+          }
+          else
+          {
+            this->items[record.row].valid[record.column] = sectors;
+          }
+          break;
         }
       }
 
       fclose(file);
     }
 
-    return bytes == this->volume->BlockSize();
-  }
+    // Only trust rows that both the index and the store know about
+    std::map<uint64_t, uint64_t> stored;
+    this->store->Scan(stored);
 
+    for (const auto & entry : stored)
+    {
+      if (this->items.find(entry.first) == this->items.end())
+      {
+        this->store->Remove(entry.first);
+      }
+    }
 
-  void Cache::UpdateTimestamp(uint64_t row, bool setDirty)
-  {
-    uint64_t now = static_cast<uint64_t>(time(nullptr));
+    // Replaying the journal counted some of the dirty data already, start over
+    uint64_t dirty = 0;
 
-    auto itr = this->items.find(row);
-    if (itr != this->items.end())
+    for (auto itr = this->items.begin(); itr != this->items.end();)
     {
-      auto range = this->timestamps.equal_range(itr->second.timestamp);
-      for (auto it = range.first; it != range.second; ++it)
+      auto entry = stored.find(itr->first);
+      if (entry == stored.end())
       {
-        if (it->second == row)
+        itr = this->items.erase(itr);
+      }
+      else
+      {
+        itr->second.bytes = entry->second;
+        this->usage += itr->second.bytes;
+
+        // Recovered dirty data is already overdue
+        itr->second.dirtied = 0;
+        for (const auto & cell : itr->second.dirty)
         {
-          this->timestamps.erase(it);
-          break;
+          dirty += countbits(cell.second) * this->sectorSize;
         }
-      }
 
-      itr->second.timestamp = now;
-      if (setDirty)
-      {
-        itr->second.dirty = true;
+        this->timestamps.emplace(itr->second.timestamp, itr->first);
+        ++itr;
       }
     }
-    else
+
+    this->dirtyBytes = dirty;
+
+    return !this->items.empty();
+  }
+
+
+  bool Cache::SaveIndex()
+  {
+    std::string indexPath = this->rootPath + "/index";
+    std::string tempPath = indexPath + ".tmp";
+    std::string journalPath = this->rootPath + "/journal";
+
+    FILE * file = fopen(tempPath.c_str(), "wb");
+    if (!file)
     {
-      this->items[row] = {
-        now,
-        setDirty
-      };
+      return false;
     }
 
-    this->timestamps.emplace(now, row);
+    IndexHeader header;
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.blockSize = this->volume->BlockSize();
+    header.sectorCount = this->sectorCount;
+    header.count = this->items.size();
 
-    if (this->items.size() > this->limit)
+    bool success = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+
+    for (auto itr = this->items.begin(); success && itr != this->items.end(); ++itr)
     {
-      this->Pop();
+      uint64_t entry[4] = { itr->first, itr->second.timestamp, itr->second.dirty.size(), itr->second.valid.size() };
+      success = fwrite(entry, 1, sizeof(entry), file) == sizeof(entry) &&
+                writecells(file, itr->second.dirty) &&
+                writecells(file, itr->second.valid);
+    }
+
+    success = (fclose(file) == 0) && success;
+
+    if (!success || rename(tempPath.c_str(), indexPath.c_str()) != 0)
+    {
+      unlink(tempPath.c_str());
+      return false;
     }
+
+    // Everything in the journal is part of the index now
+    if (this->journal)
+    {
+      fclose(this->journal);
+    }
+
+    this->journal = fopen(journalPath.c_str(), "wb");
+    this->journalBytes = 0;
+
+    return true;
+  }
+
+
+  void Cache::WriteJournal(JournalType type, uint64_t row, uint64_t column, const std::vector<bool> * sectors)
+  {
+    if (!this->journal)
+    {
+      return;
+    }
+
+    JournalRecord record;
+    record.type = type;
+    record.row = row;
+    record.column = column;
+
+    std::vector<uint8_t> bits((this->sectorCount + 7) / 8, 0);
+    if (sectors)
+    {
+      packbits(*sectors, bits);
+    }
+
+    fwrite(&record, 1, sizeof(record), this->journal);
+    fwrite(bits.data(), 1, bits.size(), this->journal);
+    fflush(this->journal);
+
+    this->journalBytes += sizeof(record) + bits.size();
   }
 }
@@ -23,28 +23,72 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
 #include <map>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
 #include <memory>
 #include "LockFreeQueue.h"
+#include "CacheBudget.h"
+#include "CacheStore.h"
+#include "Stats.h"
 #include "AsyncResult.h"
 
 namespace dfs
 {
   class Volume;
 
-  class Cache
+  class Cache : public CacheBudget::Consumer
   {
   private:
 
     struct Item
     {
       uint64_t timestamp = 0;
-      bool dirty = false;
+
+      // Bytes the row takes in the store
+      uint64_t bytes = 0;
+
+      // When the row went from clean to dirty
+      uint64_t dirtied = 0;
+
+      // Dirty sectors of each modified column in the row
+      std::map<uint64_t, std::vector<bool>> dirty;
+
+      // Sectors fetched so far of the columns that are only partially cached
+      std::map<uint64_t, std::vector<bool>> valid;
+    };
+
+    static const uint32_t INDEX_MAGIC = 0x49434442;  // "BDCI"
+
+    static const uint32_t INDEX_VERSION = 2;
+
+    struct IndexHeader
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t blockSize;
+      uint64_t sectorCount;
+      uint64_t count;
+    };
+
+    enum class JournalType : uint64_t
+    {
+      Dirty = 1,
+      Clean = 2,
+      Valid = 3
+    };
+
+    // Followed by the packed sector bitmap
+    struct JournalRecord
+    {
+      JournalType type;
+      uint64_t row;
+      uint64_t column;
     };
 
     enum class RequestType
@@ -104,14 +148,23 @@ namespace dfs
 
   public:
 
-    explicit Cache(std::string rootPath, Volume * volume, size_t limit, uint32_t flushPolicy = 60);
+    // The limit is the number of bytes the cells may take in the store. The index and journal always live
+    // under rootPath, and so do the cells unless a different store is given.
+    explicit Cache(std::string rootPath, Volume * volume, uint64_t limit, uint32_t flushPolicy = 60, size_t flushConcurrency = 8,
+                   std::unique_ptr<CacheStore> store = nullptr);
 
-    ~Cache();
+    ~Cache() override;
 
     bool Read(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
 
     bool Write(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
 
+    void SetBudget(uint64_t bytes) override;
+
+    uint64_t TakeGhostHits() override;
+
+    Json::Value GetStats() const;
+
   private:
 
     void ThreadProc();
@@ -120,32 +173,76 @@ namespace dfs
 
     bool WriteImpl(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
 
-    bool ReadFileBlock(const char * filename, uint64_t column, void * buffer);
+    // Returns false if the cell is not in the row file at all
+    bool LoadCell(uint64_t row, uint64_t column, uint8_t * cell, std::vector<bool> & valid);
+
+    // Fetches the sectors in [first, last) that are not valid yet, plus up to ahead sectors past last
+    bool FillCell(uint64_t row, uint64_t column, uint8_t * cell, std::vector<bool> & valid, size_t first, size_t last, size_t ahead = 0);
 
-    bool WriteFileBlock(const char * filename, uint64_t column, const void * buffer);
+    void SetValid(uint64_t row, uint64_t column, const std::vector<bool> & valid);
 
-    void UpdateTimestamp(uint64_t row, bool setDirty);
+    bool StoreCell(uint64_t row, uint64_t column, const void * cell);
+
+    void SetRowBytes(uint64_t row, uint64_t bytes);
+
+    void UpdateTimestamp(uint64_t row);
+
+    void SetDirty(uint64_t row, uint64_t column, const std::vector<bool> & sectors);
+
+    void ClearDirty(uint64_t row, uint64_t column);
+
+    void GetDirtyLimits(uint64_t & background, uint64_t & foreground) const;
+
+    void Throttle();
 
     void Pop();
 
     bool Flush(bool force = false);
 
+    bool LoadIndex();
+
+    bool SaveIndex();
+
+    void WriteJournal(JournalType type, uint64_t row, uint64_t column, const std::vector<bool> * sectors);
+
   private:
 
     std::string rootPath;
 
-    size_t limit;
+    std::atomic<uint64_t> limit;
+
+    std::atomic<uint64_t> usage{0};
+
+    // Bytes of dirty sectors, read by writers for throttling
+    std::atomic<uint64_t> dirtyBytes{0};
 
     uint32_t flushPolicy;
 
+    size_t flushConcurrency;
+
+    size_t sectorSize;
+
+    size_t sectorCount;
+
     Volume * volume;
 
+    std::unique_ptr<CacheStore> store;
+
     bdfs::LockFreeQueue<Request *> requests;
 
     std::multimap<uint64_t, uint64_t> timestamps;
 
     std::map<uint64_t, Item> items;
 
+    GhostList<uint64_t> ghosts;
+
+    std::atomic<uint64_t> ghostHits{0};
+
+    FILE * journal = nullptr;
+
+    // Bytes appended to the journal since the index was last saved
+    uint64_t journalBytes = 0;
+
     std::mutex mutex;
 
     std::thread thread;
@@ -155,6 +252,27 @@ namespace dfs
     std::atomic<bool> active;
 
     std::atomic<bool> hasNotification{false};
+
+    struct
+    {
+      bdfs::Counter readHits;
+      bdfs::Counter readMisses;
+      bdfs::Counter fetchedBytes;
+      bdfs::Counter writes;
+      bdfs::Counter unchangedWrites;
+      bdfs::Counter throttledWrites;
+      bdfs::Counter stalledWrites;
+      bdfs::Counter evictions;
+      bdfs::Counter flushedCells;
+      bdfs::Counter flushedBytes;
+      bdfs::Counter flushErrors;
+
+      bdfs::Histogram readLatency;
+      bdfs::Histogram writeLatency;
+      bdfs::Histogram fetchLatency;
+      bdfs::Histogram flushLatency;
+      bdfs::Histogram throttleDelay;
+    } stats;
   };
 }
 
@@ -0,0 +1,224 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include "CacheBudget.h"
+
+namespace dfs
+{
+  // Share of the global budget moved on each rebalance
+  static const uint64_t REBALANCE_STEPS = 32;
+
+  // Defaults used when bdfs.conf does not say otherwise
+  static const uint64_t DEFAULT_MEMORY_BUDGET = 256ull * 1024 * 1024;
+
+  static const uint64_t DEFAULT_DISK_BUDGET = 1024ull * 1024 * 1024;
+
+  CacheBudget::Pool CacheBudget::pools[2] = {
+    { DEFAULT_MEMORY_BUDGET, 0, {} },
+    { DEFAULT_DISK_BUDGET, 0, {} }
+  };
+
+  std::mutex CacheBudget::mutex;
+
+  std::condition_variable CacheBudget::cond;
+
+  std::thread CacheBudget::thread;
+
+  bool CacheBudget::active = false;
+
+
+  void CacheBudget::Configure(Kind kind, uint64_t total, uint64_t perVolume)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Pool & pool = pools[static_cast<int>(kind)];
+    pool.total = total;
+    pool.perVolume = perVolume;
+
+    Distribute(pool);
+  }
+
+
+  uint64_t CacheBudget::InitialBudget(Kind kind)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    const Pool & pool = pools[static_cast<int>(kind)];
+
+    return std::min(Cap(pool), pool.total / (pool.budgets.size() + 1));
+  }
+
+
+  void CacheBudget::Register(Kind kind, Consumer * consumer)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    Pool & pool = pools[static_cast<int>(kind)];
+    pool.budgets[consumer] = 0;
+
+    Distribute(pool);
+  }
+
+
+  void CacheBudget::Unregister(Consumer * consumer)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (auto & pool : pools)
+    {
+      if (pool.budgets.erase(consumer) > 0)
+      {
+        Distribute(pool);
+      }
+    }
+  }
+
+
+  void CacheBudget::Start(uint32_t interval)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (active)
+    {
+      return;
+    }
+
+    active = true;
+    thread = std::thread(&CacheBudget::ThreadProc, std::max<uint32_t>(interval, 1));
+  }
+
+
+  void CacheBudget::Stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      active = false;
+      cond.notify_all();
+    }
+
+    if (thread.joinable())
+    {
+      thread.join();
+    }
+  }
+
+
+  void CacheBudget::ThreadProc(uint32_t interval)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (active)
+    {
+      cond.wait_for(lock, std::chrono::seconds(interval));
+
+      if (active)
+      {
+        for (auto & pool : pools)
+        {
+          Rebalance(pool);
+        }
+      }
+    }
+  }
+
+
+  uint64_t CacheBudget::Cap(const Pool & pool)
+  {
+    return pool.perVolume > 0 ? std::min(pool.perVolume, pool.total) : pool.total;
+  }
+
+
+  void CacheBudget::Distribute(Pool & pool)
+  {
+    if (pool.budgets.empty())
+    {
+      return;
+    }
+
+    // Membership changed, so start over from an even split and let rebalancing learn again
+    uint64_t share = std::min(Cap(pool), pool.total / pool.budgets.size());
+
+    for (auto & entry : pool.budgets)
+    {
+      entry.second = share;
+      entry.first->SetBudget(share);
+    }
+  }
+
+
+  void CacheBudget::Rebalance(Pool & pool)
+  {
+    if (pool.budgets.size() < 2)
+    {
+      // Still drain the counter so a second volume starts from a clean slate
+      for (auto & entry : pool.budgets)
+      {
+        entry.first->TakeGhostHits();
+      }
+
+      return;
+    }
+
+    // Never squeeze a volume below a quarter of its even share
+    const uint64_t floor = pool.total / (pool.budgets.size() * 4);
+    const uint64_t cap = Cap(pool);
+
+    Consumer * gainer = nullptr;
+    Consumer * loser = nullptr;
+    uint64_t most = 0;
+    uint64_t least = UINT64_MAX;
+
+    for (auto & entry : pool.budgets)
+    {
+      uint64_t hits = entry.first->TakeGhostHits();
+
+      if (entry.second < cap && (!gainer || hits > most))
+      {
+        gainer = entry.first;
+        most = hits;
+      }
+
+      if (entry.second > floor && (!loser || hits < least))
+      {
+        loser = entry.first;
+        least = hits;
+      }
+    }
+
+    if (!gainer || !loser || gainer == loser || most <= least)
+    {
+      return;
+    }
+
+    uint64_t step = std::max<uint64_t>(pool.total / REBALANCE_STEPS, 1);
+    step = std::min(step, cap - pool.budgets[gainer]);
+    step = std::min(step, pool.budgets[loser] - floor);
+
+    pool.budgets[loser] -= step;
+    pool.budgets[gainer] += step;
+
+    loser->SetBudget(pool.budgets[loser]);
+    gainer->SetBudget(pool.budgets[gainer]);
+  }
+}
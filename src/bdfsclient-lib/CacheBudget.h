@@ -0,0 +1,166 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace dfs
+{
+  // Remembers keys that were recently evicted from a cache. A miss on one of
+  // them is a hit the cache would have had with a bit more room, which is what
+  // CacheBudget uses as the marginal utility of growing that cache.
+  template<typename Key>
+  class GhostList
+  {
+  public:
+
+    void SetCapacity(size_t value)
+    {
+      this->capacity = value;
+      while (this->keys.size() > this->capacity)
+      {
+        this->index.erase(this->keys.front());
+        this->keys.pop_front();
+      }
+    }
+
+    void Add(const Key & key)
+    {
+      if (this->capacity == 0 || this->index.find(key) != this->index.end())
+      {
+        return;
+      }
+
+      if (this->keys.size() >= this->capacity)
+      {
+        this->index.erase(this->keys.front());
+        this->keys.pop_front();
+      }
+
+      this->index[key] = this->keys.emplace(this->keys.end(), key);
+    }
+
+    bool Take(const Key & key)
+    {
+      auto itr = this->index.find(key);
+      if (itr == this->index.end())
+      {
+        return false;
+      }
+
+      this->keys.erase(itr->second);
+      this->index.erase(itr);
+
+      return true;
+    }
+
+  private:
+
+    size_t capacity = 0;
+
+    std::list<Key> keys;
+
+    std::map<Key, typename std::list<Key>::iterator> index;
+  };
+
+
+  // Process wide byte budgets for the caches of all bound volumes. Each kind of
+  // storage has a global limit which is split between the registered caches,
+  // optionally capped per volume. A background thread periodically moves part
+  // of the budget from the cache with the fewest ghost hits to the one with the
+  // most, so that space goes where it buys the most hits.
+  class CacheBudget
+  {
+  public:
+
+    enum class Kind
+    {
+      Memory = 0,
+      Disk = 1
+    };
+
+    class Consumer
+    {
+    public:
+
+      virtual ~Consumer() = default;
+
+      virtual void SetBudget(uint64_t bytes) = 0;
+
+      // Returns the number of ghost hits since the last call
+      virtual uint64_t TakeGhostHits() = 0;
+    };
+
+  public:
+
+    // A per volume limit of 0 means the volume may use the whole global budget
+    static void Configure(Kind kind, uint64_t total, uint64_t perVolume);
+
+    // Budget a new consumer of the kind starts with before it is registered
+    static uint64_t InitialBudget(Kind kind);
+
+    static void Register(Kind kind, Consumer * consumer);
+
+    // Consumers must unregister before they are destroyed. Unknown consumers are ignored.
+    static void Unregister(Consumer * consumer);
+
+    static void Start(uint32_t interval = 10);
+
+    static void Stop();
+
+  private:
+
+    struct Pool
+    {
+      uint64_t total = 0;
+      uint64_t perVolume = 0;
+      std::map<Consumer *, uint64_t> budgets;
+    };
+
+    static void ThreadProc(uint32_t interval);
+
+    static void Distribute(Pool & pool);
+
+    static void Rebalance(Pool & pool);
+
+    static uint64_t Cap(const Pool & pool);
+
+  private:
+
+    static Pool pools[2];
+
+    static std::mutex mutex;
+
+    static std::condition_variable cond;
+
+    static std::thread thread;
+
+    static bool active;
+  };
+}
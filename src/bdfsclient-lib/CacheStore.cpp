@@ -0,0 +1,180 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined( _WIN32)
+#include "dirent-win.h"
+#else
+#include <unistd.h>
+#include <dirent.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "CacheStore.h"
+
+namespace dfs
+{
+  FileCacheStore::FileCacheStore(std::string rootPath, size_t blockSize)
+    : rootPath(std::move(rootPath))
+    , blockSize(blockSize)
+  {
+  }
+
+
+  std::string FileCacheStore::GetPath(uint64_t row) const
+  {
+    char name[32];
+    sprintf(name, "/%" PRIu64 "", row);
+
+    return this->rootPath + name;
+  }
+
+
+  bool FileCacheStore::Read(uint64_t row, uint64_t column, void * buffer)
+  {
+    size_t bytes = 0;
+
+    FILE * file = fopen(this->GetPath(row).c_str(), "rb");
+    if (file)
+    {
+      uint64_t idx = 0;
+
+      while (fread(&idx, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
+      {
+        if (idx == column)
+        {
+          bytes = fread(buffer, 1, this->blockSize, file);
+          break;
+        }
+        else
+        {
+          fseek(file, static_cast<long>(this->blockSize), SEEK_CUR);
+        }
+      }
+
+      fclose(file);
+    }
+
+    return bytes == this->blockSize;
+  }
+
+
+  bool FileCacheStore::Write(uint64_t row, uint64_t column, const void * buffer, uint64_t & rowBytes)
+  {
+    size_t bytes = 0;
+
+    std::string path = this->GetPath(row);
+
+    FILE * file = fopen(path.c_str(), "rb+");
+    if (!file)
+    {
+      file = fopen(path.c_str(), "wb+");
+    }
+
+    if (file)
+    {
+      uint64_t idx = 0;
+
+      while (fread(&idx, 1, sizeof(uint64_t), file) == sizeof(uint64_t))
+      {
+        if (idx == column)
+        {
+          fseek(file, 0, SEEK_CUR);
+          bytes = fwrite(buffer, 1, this->blockSize, file);
+          break;
+        }
+        else
+        {
+          fseek(file, static_cast<long>(this->blockSize), SEEK_CUR);
+        }
+      }
+
+      if (bytes != this->blockSize)
+      {
+        fseek(file, 0, SEEK_CUR);
+        if (fwrite(&column, 1, sizeof(column), file) == sizeof(column))
+        {
+          bytes = fwrite(buffer, 1, this->blockSize, file);
+        }
+      }
+
+      if (fseek(file, 0, SEEK_END) == 0)
+      {
+        rowBytes = static_cast<uint64_t>(ftell(file));
+      }
+
+      fclose(file);
+    }
+
+    return bytes == this->blockSize;
+  }
+
+
+  void FileCacheStore::Remove(uint64_t row)
+  {
+    unlink(this->GetPath(row).c_str());
+  }
+
+
+  void FileCacheStore::Scan(std::map<uint64_t, uint64_t> & rows)
+  {
+    DIR * dir = opendir(this->rootPath.c_str());
+    if (!dir)
+    {
+      return;
+    }
+
+    struct dirent * ent;
+    while ((ent = readdir(dir)) != nullptr)
+    {
+      if (ent->d_type != DT_REG || ent->d_name[0] == '.')
+      {
+        continue;
+      }
+
+      // Skip the index and anything else that is not a row
+      char * end = nullptr;
+      uint64_t row = strtoull(ent->d_name, &end, 10);
+      if (!end || *end != '\0')
+      {
+        continue;
+      }
+
+      std::string path = this->GetPath(row);
+
+      // A size that is not a whole number of records means a write was torn
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 ||
+          static_cast<uint64_t>(st.st_size) % (sizeof(uint64_t) + this->blockSize) != 0)
+      {
+        unlink(path.c_str());
+        continue;
+      }
+
+      rows[row] = static_cast<uint64_t>(st.st_size);
+    }
+
+    closedir(dir);
+  }
+}
@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+
+namespace dfs
+{
+  // Where Cache keeps the cells it holds locally. All calls come from the
+  // cache thread, so implementations do not need to lock.
+  class CacheStore
+  {
+  public:
+
+    virtual ~CacheStore() = default;
+
+    // Reads a whole cell, false if the store does not have it
+    virtual bool Read(uint64_t row, uint64_t column, void * buffer) = 0;
+
+    // Writes a whole cell and returns the bytes the row now takes in rowBytes
+    virtual bool Write(uint64_t row, uint64_t column, const void * buffer, uint64_t & rowBytes) = 0;
+
+    virtual void Remove(uint64_t row) = 0;
+
+    // Returns the rows that survived the previous run with the bytes they take,
+    // after discarding anything that cannot be trusted
+    virtual void Scan(std::map<uint64_t, uint64_t> & rows) = 0;
+
+    // Bytes the store can hold at most, 0 if only the cache budget limits it
+    virtual uint64_t Capacity() const = 0;
+  };
+
+
+  // Keeps each row in its own file of [column][cell] records under the cache
+  // folder, going through the page cache
+  class FileCacheStore : public CacheStore
+  {
+  public:
+
+    FileCacheStore(std::string rootPath, size_t blockSize);
+
+    bool Read(uint64_t row, uint64_t column, void * buffer) override;
+
+    bool Write(uint64_t row, uint64_t column, const void * buffer, uint64_t & rowBytes) override;
+
+    void Remove(uint64_t row) override;
+
+    void Scan(std::map<uint64_t, uint64_t> & rows) override;
+
+    uint64_t Capacity() const override  { return 0; }
+
+  private:
+
+    std::string GetPath(uint64_t row) const;
+
+  private:
+
+    std::string rootPath;
+
+    size_t blockSize;
+  };
+}
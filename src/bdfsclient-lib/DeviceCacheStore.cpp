@@ -0,0 +1,409 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "DeviceCacheStore.h"
+
+namespace dfs
+{
+  static uint64_t alignup(uint64_t value, uint64_t alignment)
+  {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+
+  static void * alignedalloc(size_t size, size_t alignment)
+  {
+    void * ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0)
+    {
+      return nullptr;
+    }
+
+    return ptr;
+  }
+
+
+  std::unique_ptr<DeviceCacheStore> DeviceCacheStore::Open(const std::string & path, const std::string & volume, size_t blockSize)
+  {
+    // The superblock keeps the name with its terminator, a longer one would never match and the
+    // device would be formatted again on every open
+    if (volume.empty() || volume.size() >= sizeof(Superblock::volume))
+    {
+      printf("Error: volume name '%s' is too long for a cache device.\n", volume.c_str());
+      return nullptr;
+    }
+
+#if defined(O_DIRECT)
+    int fd = open(path.c_str(), O_RDWR | O_DIRECT);
+#else
+    int fd = open(path.c_str(), O_RDWR);
+#if defined(F_NOCACHE)
+    if (fd >= 0)
+    {
+      fcntl(fd, F_NOCACHE, 1);
+    }
+#endif
+#endif
+
+    if (fd < 0)
+    {
+      printf("Error: failed to open cache device '%s' (%d).\n", path.c_str(), errno);
+      return nullptr;
+    }
+
+    // Works for block devices as well as for preallocated files
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    std::unique_ptr<DeviceCacheStore> store(new DeviceCacheStore(fd, blockSize));
+
+    if (size <= 0 || !store->buffer || !store->Load(volume, static_cast<uint64_t>(size)))
+    {
+      printf("Error: cache device '%s' is unusable for volume '%s'.\n", path.c_str(), volume.c_str());
+      return nullptr;
+    }
+
+    return store;
+  }
+
+
+  DeviceCacheStore::DeviceCacheStore(int fd, size_t blockSize)
+    : fd(fd)
+    , blockSize(blockSize)
+  {
+    memset(&this->super, 0, sizeof(this->super));
+    this->buffer = static_cast<uint8_t *>(alignedalloc(alignup(blockSize, ALIGNMENT), ALIGNMENT));
+  }
+
+
+  DeviceCacheStore::~DeviceCacheStore()
+  {
+    free(this->table);
+    free(this->buffer);
+
+    if (this->fd >= 0)
+    {
+      close(this->fd);
+    }
+  }
+
+
+  bool DeviceCacheStore::Load(const std::string & volume, uint64_t deviceSize)
+  {
+    uint8_t * page = static_cast<uint8_t *>(alignedalloc(ALIGNMENT, ALIGNMENT));
+    if (!page)
+    {
+      return false;
+    }
+
+    bool valid = pread(this->fd, page, ALIGNMENT, 0) == static_cast<ssize_t>(ALIGNMENT);
+    if (valid)
+    {
+      memcpy(&this->super, page, sizeof(this->super));
+    }
+
+    free(page);
+
+    valid = valid &&
+            this->super.magic == MAGIC &&
+            this->super.version == VERSION &&
+            this->super.blockSize == this->blockSize &&
+            this->super.slotSize == alignup(this->blockSize, ALIGNMENT) &&
+            this->super.dataOffset + this->super.slotCount * this->super.slotSize <= deviceSize &&
+            strncmp(this->super.volume, volume.c_str(), sizeof(this->super.volume)) == 0 &&
+            this->super.volume[sizeof(this->super.volume) - 1] == '\0';
+
+    if (!valid)
+    {
+      return this->Format(volume, deviceSize);
+    }
+
+    this->tableSize = alignup(this->super.slotCount * sizeof(Slot), ALIGNMENT);
+    this->table = static_cast<Slot *>(alignedalloc(this->tableSize, ALIGNMENT));
+
+    if (!this->table ||
+        pread(this->fd, this->table, this->tableSize, this->super.tableOffset) != static_cast<ssize_t>(this->tableSize))
+    {
+      return false;
+    }
+
+    for (uint64_t i = 0; i < this->super.slotCount; ++i)
+    {
+      Slot & slot = this->table[i];
+      if (slot.row == FREE)
+      {
+        this->freeSlots.emplace_back(i);
+        continue;
+      }
+
+      this->sequence = std::max(this->sequence, slot.sequence);
+
+      auto & columns = this->rows[slot.row];
+      auto cell = columns.find(slot.column);
+      if (cell != columns.end())
+      {
+        // Left over from an update that was interrupted before it released the old slot, the newer one wins
+        uint64_t stale = i;
+        if (this->table[cell->second].sequence < slot.sequence)
+        {
+          stale = cell->second;
+          cell->second = i;
+        }
+
+        this->table[stale].row = FREE;
+        this->table[stale].column = FREE;
+        this->WriteTable(stale);
+        this->freeSlots.emplace_back(stale);
+        continue;
+      }
+
+      columns[slot.column] = i;
+    }
+
+    // Hand out low slots first
+    std::reverse(this->freeSlots.begin(), this->freeSlots.end());
+
+    return true;
+  }
+
+
+  bool DeviceCacheStore::Format(const std::string & volume, uint64_t deviceSize)
+  {
+    const uint64_t slotSize = alignup(this->blockSize, ALIGNMENT);
+
+    if (deviceSize < 2 * ALIGNMENT + slotSize)
+    {
+      return false;
+    }
+
+    // One page of superblock, the table, then as many slots as fit
+    uint64_t slotCount = (deviceSize - 2 * ALIGNMENT) / (slotSize + sizeof(Slot));
+    while (slotCount > 0 && ALIGNMENT + alignup(slotCount * sizeof(Slot), ALIGNMENT) + slotCount * slotSize > deviceSize)
+    {
+      --slotCount;
+    }
+
+    if (slotCount == 0)
+    {
+      return false;
+    }
+
+    memset(&this->super, 0, sizeof(this->super));
+    this->super.magic = MAGIC;
+    this->super.version = VERSION;
+    this->super.blockSize = this->blockSize;
+    this->super.slotSize = slotSize;
+    this->super.slotCount = slotCount;
+    this->super.tableOffset = ALIGNMENT;
+    this->super.dataOffset = ALIGNMENT + alignup(slotCount * sizeof(Slot), ALIGNMENT);
+    strncpy(this->super.volume, volume.c_str(), sizeof(this->super.volume) - 1);
+
+    free(this->table);
+    this->tableSize = alignup(slotCount * sizeof(Slot), ALIGNMENT);
+    this->table = static_cast<Slot *>(alignedalloc(this->tableSize, ALIGNMENT));
+    if (!this->table)
+    {
+      return false;
+    }
+
+    memset(this->table, 0xFF, this->tableSize);
+
+    if (pwrite(this->fd, this->table, this->tableSize, this->super.tableOffset) != static_cast<ssize_t>(this->tableSize))
+    {
+      return false;
+    }
+
+    // The superblock goes last so that a device is never valid with a stale table
+    uint8_t * page = static_cast<uint8_t *>(alignedalloc(ALIGNMENT, ALIGNMENT));
+    if (!page)
+    {
+      return false;
+    }
+
+    memset(page, 0, ALIGNMENT);
+    memcpy(page, &this->super, sizeof(this->super));
+
+    bool success = pwrite(this->fd, page, ALIGNMENT, 0) == static_cast<ssize_t>(ALIGNMENT);
+
+    free(page);
+
+    this->rows.clear();
+    this->freeSlots.clear();
+    for (uint64_t i = slotCount; i > 0; --i)
+    {
+      this->freeSlots.emplace_back(i - 1);
+    }
+
+    return success;
+  }
+
+
+  bool DeviceCacheStore::WriteTable(uint64_t slot)
+  {
+    static_assert(ALIGNMENT % sizeof(Slot) == 0, "a table entry must not straddle a page");
+
+    uint64_t offset = slot * sizeof(Slot) / ALIGNMENT * ALIGNMENT;
+
+    return pwrite(this->fd, reinterpret_cast<uint8_t *>(this->table) + offset, ALIGNMENT, this->super.tableOffset + offset) == static_cast<ssize_t>(ALIGNMENT);
+  }
+
+
+  bool DeviceCacheStore::Read(uint64_t row, uint64_t column, void * buffer)
+  {
+    auto itr = this->rows.find(row);
+    if (itr == this->rows.end())
+    {
+      return false;
+    }
+
+    auto cell = itr->second.find(column);
+    if (cell == itr->second.end())
+    {
+      return false;
+    }
+
+    uint64_t offset = this->super.dataOffset + cell->second * this->super.slotSize;
+    if (pread(this->fd, this->buffer, this->super.slotSize, offset) != static_cast<ssize_t>(this->super.slotSize))
+    {
+      return false;
+    }
+
+    memcpy(buffer, this->buffer, this->blockSize);
+
+    return true;
+  }
+
+
+  bool DeviceCacheStore::Write(uint64_t row, uint64_t column, const void * buffer, uint64_t & rowBytes)
+  {
+    auto & columns = this->rows[row];
+
+    auto cell = columns.find(column);
+    bool allocated = cell == columns.end();
+
+    // The last free slot is kept for new versions of cached cells, which always need one
+    if (this->freeSlots.size() < (allocated ? 2 : 1))
+    {
+      if (columns.empty())
+      {
+        this->rows.erase(row);
+      }
+
+      return false;
+    }
+
+    uint64_t slot = this->freeSlots.back();
+
+    memcpy(this->buffer, buffer, this->blockSize);
+    memset(this->buffer + this->blockSize, 0, this->super.slotSize - this->blockSize);
+
+    uint64_t offset = this->super.dataOffset + slot * this->super.slotSize;
+    bool success = pwrite(this->fd, this->buffer, this->super.slotSize, offset) == static_cast<ssize_t>(this->super.slotSize);
+
+    if (success)
+    {
+      // Only claim the slot once its data is on the device
+      this->table[slot].row = row;
+      this->table[slot].column = column;
+      this->table[slot].sequence = ++this->sequence;
+
+      success = this->WriteTable(slot);
+      if (!success)
+      {
+        this->table[slot].row = FREE;
+        this->table[slot].column = FREE;
+      }
+    }
+
+    if (!success)
+    {
+      if (columns.empty())
+      {
+        this->rows.erase(row);
+      }
+
+      return false;
+    }
+
+    this->freeSlots.pop_back();
+
+    if (!allocated)
+    {
+      // The new version is in the table, the old one can go. Should this not reach the device the
+      // sequence tells the two apart on the next load.
+      uint64_t old = cell->second;
+      this->table[old].row = FREE;
+      this->table[old].column = FREE;
+      this->WriteTable(old);
+      this->freeSlots.emplace_back(old);
+    }
+
+    columns[column] = slot;
+
+    rowBytes = columns.size() * this->super.slotSize;
+
+    return true;
+  }
+
+
+  void DeviceCacheStore::Remove(uint64_t row)
+  {
+    auto itr = this->rows.find(row);
+    if (itr == this->rows.end())
+    {
+      return;
+    }
+
+    for (const auto & cell : itr->second)
+    {
+      this->table[cell.second].row = FREE;
+      this->table[cell.second].column = FREE;
+      this->WriteTable(cell.second);
+      this->freeSlots.emplace_back(cell.second);
+    }
+
+    this->rows.erase(itr);
+  }
+
+
+  void DeviceCacheStore::Scan(std::map<uint64_t, uint64_t> & rows)
+  {
+    for (const auto & entry : this->rows)
+    {
+      rows[entry.first] = entry.second.size() * this->super.slotSize;
+    }
+  }
+
+
+  uint64_t DeviceCacheStore::Capacity() const
+  {
+    return this->super.slotCount * this->super.slotSize;
+  }
+}
@@ -0,0 +1,130 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+#include "CacheStore.h"
+
+namespace dfs
+{
+  // Keeps cells in fixed size slots on a raw block device or a preallocated
+  // file, bypassing the page cache with O_DIRECT. The device starts with a
+  // superblock naming the volume and its geometry, followed by a table that
+  // maps every slot to the cell it holds. A slot is only entered in the table
+  // after its data has been written, so the device describes itself after a
+  // restart and no separate file needs to stay in sync with it. Cells are
+  // never overwritten in place: a new version goes to a free slot and the
+  // old slot is released once the table points at the new one, so a crash
+  // can never leave a torn cell behind a valid table entry.
+  class DeviceCacheStore : public CacheStore
+  {
+  private:
+
+    static const uint32_t MAGIC = 0x44434442;  // "BDCD"
+
+    static const uint32_t VERSION = 2;
+
+    // Every offset and size used with O_DIRECT is a multiple of this
+    static const size_t ALIGNMENT = 4096;
+
+    struct Superblock
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t blockSize;
+      uint64_t slotSize;
+      uint64_t slotCount;
+      uint64_t tableOffset;
+      uint64_t dataOffset;
+      char volume[64];
+    };
+
+    // A power of two in size so that no entry straddles a table page
+    struct Slot
+    {
+      uint64_t row;
+      uint64_t column;
+
+      // Orders the versions of a cell if a crash left two entries for it
+      uint64_t sequence;
+      uint64_t reserved;
+    };
+
+    static const uint64_t FREE = UINT64_MAX;
+
+  public:
+
+    // Returns nullptr if the device cannot be opened or is too small. A device
+    // that was set up for another volume or cell size is formatted again.
+    static std::unique_ptr<DeviceCacheStore> Open(const std::string & path, const std::string & volume, size_t blockSize);
+
+    ~DeviceCacheStore() override;
+
+    bool Read(uint64_t row, uint64_t column, void * buffer) override;
+
+    bool Write(uint64_t row, uint64_t column, const void * buffer, uint64_t & rowBytes) override;
+
+    void Remove(uint64_t row) override;
+
+    void Scan(std::map<uint64_t, uint64_t> & rows) override;
+
+    uint64_t Capacity() const override;
+
+  private:
+
+    DeviceCacheStore(int fd, size_t blockSize);
+
+    bool Load(const std::string & volume, uint64_t deviceSize);
+
+    bool Format(const std::string & volume, uint64_t deviceSize);
+
+    bool WriteTable(uint64_t slot);
+
+  private:
+
+    int fd;
+
+    size_t blockSize;
+
+    Superblock super;
+
+    // Slot table as it is on the device, aligned for O_DIRECT
+    Slot * table = nullptr;
+
+    size_t tableSize = 0;
+
+    // Aligned bounce buffer of one slot
+    uint8_t * buffer = nullptr;
+
+    std::map<uint64_t, std::map<uint64_t, uint64_t>> rows;
+
+    std::vector<uint64_t> freeSlots;
+
+    uint64_t sequence = 0;
+  };
+}
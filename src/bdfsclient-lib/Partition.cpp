@@ -21,7 +21,9 @@
 */
 
 #include <string.h>
+#include <atomic>
 #include "Partition.h"
+#include "HedgeBudget.h"
 
 namespace dfs
 {
@@ -47,25 +49,104 @@ namespace dfs
 
   bool Partition::ReadBlock(uint64_t index, void * buffer, size_t size, size_t offset)
   {
-    auto result = ref->Read(index, offset, size);
-    if (result->Wait(ref->GetTimeout()))
+    // The attempts race, the first one to succeed claims the read
+    struct Race
     {
-      auto & buf = result->GetResult();
-      if (buf.size() == size)
+      std::atomic<bool> claimed{false};
+      std::atomic<int> remaining{1};
+      bdfs::AsyncResult<int> winner;
+    };
+
+    auto race = std::make_shared<Race>();
+
+    auto finish = [race](int attempt, ssize_t received)
+    {
+      bool last = --race->remaining == 0;
+      if ((received >= 0 || last) && !race->claimed.exchange(true))
       {
-        memcpy(buffer, &buf[0], size);
-        return true;
+        race->winner.Complete(received >= 0 ? attempt : -1);
       }
+    };
+
+    bdfs::StopWatch watch;
+    uint32_t timeout = ref->GetBlockTimeout();
+
+    bdfs::HedgeBudget::OnRead();
+
+    auto target = std::make_shared<bdfs::ReceiveBuffer>(buffer, size);
+    if (!ref->Read(index, offset, target, size, false, [finish](ssize_t received) { finish(0, received); }))
+    {
+      return false;
     }
 
-    return false;
+    // A hedge lands in its own buffer since the first attempt may still be writing to the caller's
+    std::unique_ptr<uint8_t[]> scratch;
+    bdfs::ReceiveBufferPtr hedge;
+
+    uint32_t delay = ref->GetHedgeDelay();
+    if (delay > 0 && delay < timeout && !race->winner.Wait(delay) && bdfs::HedgeBudget::TryAcquire())
+    {
+      scratch.reset(new uint8_t[size]);
+      hedge = std::make_shared<bdfs::ReceiveBuffer>(scratch.get(), size);
+
+      ++race->remaining;
+      if (!ref->Read(index, offset, hedge, size, true, [finish](ssize_t received) { finish(1, received); }))
+      {
+        // The first attempt may have failed in the meantime, it left the race to the hedge then
+        finish(1, -1);
+      }
+    }
+
+    uint64_t elapsed = watch.ElapsedMicros() / 1000;
+    if (elapsed < timeout)
+    {
+      race->winner.Wait(static_cast<int>(timeout - elapsed));
+    }
+
+    // Attempts that are still running must stay away from memory we are about to release
+    target->Detach();
+    if (hedge)
+    {
+      hedge->Detach();
+    }
+
+    if (!race->winner.IsCompleted() || race->winner.GetResult() < 0)
+    {
+      return false;
+    }
+
+    if (race->winner.GetResult() == 1)
+    {
+      memcpy(buffer, scratch.get(), size);
+      bdfs::HedgeBudget::OnWin();
+    }
+
+    return true;
   }
 
 
   bool Partition::WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset)
   {
-    auto result = ref->Write(index, offset, buffer, size);
-    if (result->Wait(ref->GetTimeout()))
+    auto body = std::make_shared<bdfs::SendBuffer>(buffer, size);
+
+    auto result = this->WriteBlockAsync(index, body, offset);
+    bool success = result && result->Wait(ref->GetBlockTimeout()) && result->GetResult() == static_cast<ssize_t>(size);
+
+    // The transfer may still be running, keep it away from the caller's memory
+    body->Detach();
+    return success;
+  }
+
+
+  bdfs::AsyncResultPtr<ssize_t> Partition::WriteBlockAsync(uint64_t index, bdfs::SendBufferPtr body, size_t offset)
+  {
+    return ref->Write(index, offset, std::move(body));
+  }
+
+
+  bool Partition::WaitWrite(const bdfs::AsyncResultPtr<ssize_t> & result, size_t size)
+  {
+    if (result && result->Wait(ref->GetTimeout()))
     {
       return result->GetResult() == static_cast<ssize_t>(size);
     }
@@ -74,10 +155,16 @@ namespace dfs
   }
 
 
+  bdfs::AsyncResultPtr<ssize_t> Partition::WriteBlocksAsync(const std::vector<bdfs::BlockExtent> & extents, bdfs::SendBufferPtr body)
+  {
+    return ref->WriteBlocks(extents, std::move(body));
+  }
+
+
   bool Partition::Delete()
   {
     auto result = ref->Delete();
-    if (result->Wait(ref->GetTimeout()))
+    if (result && result->Wait(ref->GetTimeout()))
     {
       return result->GetResult();
     }
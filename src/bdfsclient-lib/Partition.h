@@ -40,6 +40,14 @@ namespace dfs
     bool ReadBlock(uint64_t index, void * buffer, size_t size, size_t offset);
     bool WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset);
 
+    // The body is streamed while the write is in flight. Callers keep it alive
+    // until WaitWrite returns and detach it afterwards in case of a timeout.
+    bdfs::AsyncResultPtr<ssize_t> WriteBlockAsync(uint64_t index, bdfs::SendBufferPtr body, size_t offset);
+    bool WaitWrite(const bdfs::AsyncResultPtr<ssize_t> & result, size_t size);
+
+    // Several extents in one request, the body holds their contents back to back
+    bdfs::AsyncResultPtr<ssize_t> WriteBlocksAsync(const std::vector<bdfs::BlockExtent> & extents, bdfs::SendBufferPtr body);
+
     bool Delete();
 
     uint32_t GetTimeout() const;
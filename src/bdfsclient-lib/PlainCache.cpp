@@ -0,0 +1,322 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#endif
+#include "PlainCache.h"
+
+namespace dfs
+{
+  PlainCache::PlainCache(size_t cellSize, uint64_t limit, bool compress)
+    : cellSize(cellSize)
+    , limit(limit)
+    , compress(compress)
+    , generations(GENERATION_SLOTS, 0)
+  {
+    assert(cellSize > 0);
+
+#if defined(HAVE_LZ4)
+    if (this->compress)
+    {
+      this->scratch.reset(new uint8_t[this->cellSize]);
+    }
+#else
+    if (this->compress)
+    {
+      printf("Warning: built without LZ4, the plaintext cache is not compressed.\n");
+      this->compress = false;
+    }
+#endif
+  }
+
+
+  PlainCache::~PlainCache()
+  {
+    CacheBudget::Unregister(this);
+  }
+
+
+  bool PlainCache::Read(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
+  {
+    if (size + offset > this->cellSize)
+    {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    auto itr = this->items.find(Key(row, column));
+    if (itr == this->items.end())
+    {
+      this->misses.Add();
+
+      if (this->ghosts.Take(Key(row, column)))
+      {
+        ++this->ghostHits;
+      }
+
+      return false;
+    }
+
+    this->hits.Add();
+
+    // Move to the most recently used position
+    this->entries.splice(this->entries.end(), this->entries, itr->second);
+
+    const Entry & entry = *itr->second;
+
+#if defined(HAVE_LZ4)
+    if (entry.compressed)
+    {
+      // LZ4 decodes front to back, so stop once the requested range is out
+      int length = LZ4_decompress_safe_partial(reinterpret_cast<const char *>(entry.data.get()),
+                                               reinterpret_cast<char *>(this->scratch.get()),
+                                               static_cast<int>(entry.size),
+                                               static_cast<int>(offset + size),
+                                               static_cast<int>(this->cellSize));
+      if (length < static_cast<int>(offset + size))
+      {
+        this->usage -= entry.size;
+        this->entries.erase(itr->second);
+        this->items.erase(itr);
+        return false;
+      }
+
+      memcpy(buffer, this->scratch.get() + offset, size);
+      return true;
+    }
+#endif
+
+    memcpy(buffer, entry.data.get() + offset, size);
+
+    return true;
+  }
+
+
+  void PlainCache::Write(uint64_t row, uint64_t column, const void * buffer)
+  {
+    this->Store(row, column, buffer, nullptr);
+  }
+
+
+  uint64_t PlainCache::Generation(uint64_t row, uint64_t column)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->GenerationSlot(row, column);
+  }
+
+
+  bool PlainCache::Fill(uint64_t row, uint64_t column, const void * buffer, uint64_t generation)
+  {
+    return this->Store(row, column, buffer, &generation);
+  }
+
+
+  bool PlainCache::Store(uint64_t row, uint64_t column, const void * buffer, const uint64_t * generation)
+  {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size = this->cellSize;
+    bool compressed = false;
+
+#if defined(HAVE_LZ4)
+    // Compress before taking the lock, readers only ever wait for a decompression
+    if (this->compress)
+    {
+      int bound = LZ4_compressBound(static_cast<int>(this->cellSize));
+      std::unique_ptr<uint8_t[]> packed(new uint8_t[bound]);
+
+      int length = LZ4_compress_default(reinterpret_cast<const char *>(buffer),
+                                        reinterpret_cast<char *>(packed.get()),
+                                        static_cast<int>(this->cellSize),
+                                        bound);
+
+      if (length > 0 && static_cast<size_t>(length) < this->cellSize)
+      {
+        data.reset(new uint8_t[length]);
+        memcpy(data.get(), packed.get(), length);
+        size = static_cast<size_t>(length);
+        compressed = true;
+      }
+      else
+      {
+        this->incompressible.Add();
+      }
+    }
+#endif
+
+    if (!data)
+    {
+      data.reset(new uint8_t[this->cellSize]);
+      memcpy(data.get(), buffer, this->cellSize);
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    uint64_t & current = this->GenerationSlot(row, column);
+    if (generation)
+    {
+      // The cell was written since the reader took the generation, its plaintext is stale
+      if (current != *generation)
+      {
+        return false;
+      }
+    }
+    else
+    {
+      ++current;
+    }
+
+    if (this->limit < this->cellSize)
+    {
+      return false;
+    }
+
+    Key key(row, column);
+
+    auto itr = this->items.find(key);
+    if (itr != this->items.end())
+    {
+      this->entries.splice(this->entries.end(), this->entries, itr->second);
+      this->SetData(*itr->second, std::move(data), size, compressed);
+    }
+    else
+    {
+      this->ghosts.Take(key);
+
+      Entry entry;
+      entry.key = key;
+      entry.size = 0;
+      entry.compressed = false;
+
+      auto pos = this->entries.emplace(this->entries.end(), std::move(entry));
+      this->SetData(*pos, std::move(data), size, compressed);
+      this->items[key] = pos;
+    }
+
+    // The entry just written is the most recently used, so it goes last
+    while (this->usage > this->limit && this->entries.size() > 1)
+    {
+      this->Pop();
+    }
+
+    return true;
+  }
+
+
+  void PlainCache::Invalidate(uint64_t row, uint64_t column)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    ++this->GenerationSlot(row, column);
+
+    auto itr = this->items.find(Key(row, column));
+    if (itr != this->items.end())
+    {
+      this->usage -= itr->second->size;
+      this->entries.erase(itr->second);
+      this->items.erase(itr);
+    }
+  }
+
+
+  void PlainCache::SetBudget(uint64_t bytes)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->limit = bytes;
+
+    while (!this->entries.empty() && this->usage > this->limit)
+    {
+      this->Pop();
+    }
+  }
+
+
+  uint64_t PlainCache::TakeGhostHits()
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    uint64_t result = this->ghostHits;
+    this->ghostHits = 0;
+
+    return result;
+  }
+
+
+  Json::Value PlainCache::GetStats()
+  {
+    Json::Value json;
+
+    json["counters"]["hits"] = Json::Value::UInt(this->hits.Get());
+    json["counters"]["misses"] = Json::Value::UInt(this->misses.Get());
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    uint64_t cells = this->items.size() * this->cellSize;
+
+    json["counters"]["incompressible"] = Json::Value::UInt(this->incompressible.Get());
+    json["gauges"]["usedBytes"] = Json::Value::UInt(this->usage);
+    json["gauges"]["limitBytes"] = Json::Value::UInt(this->limit);
+    json["gauges"]["cachedBytes"] = Json::Value::UInt(cells);
+    json["gauges"]["compressionRatio"] = this->usage > 0 ? static_cast<double>(cells) / this->usage : 1.0;
+
+    return json;
+  }
+
+
+  uint64_t & PlainCache::GenerationSlot(uint64_t row, uint64_t column)
+  {
+    uint64_t hash = row * 0x9e3779b97f4a7c15ULL ^ column;
+    return this->generations[hash % GENERATION_SLOTS];
+  }
+
+
+  void PlainCache::Pop()
+  {
+    if (!this->entries.empty())
+    {
+      // Remember about as many evicted cells as are cached
+      this->ghosts.SetCapacity(std::max<size_t>(this->items.size(), 16));
+      this->ghosts.Add(this->entries.front().key);
+
+      this->usage -= this->entries.front().size;
+      this->items.erase(this->entries.front().key);
+      this->entries.pop_front();
+    }
+  }
+
+
+  void PlainCache::SetData(Entry & entry, std::unique_ptr<uint8_t[]> data, size_t size, bool compressed)
+  {
+    this->usage -= entry.size;
+    this->usage += size;
+
+    entry.data = std::move(data);
+    entry.size = size;
+    entry.compressed = compressed;
+  }
+}
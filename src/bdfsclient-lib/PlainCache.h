@@ -0,0 +1,133 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include "CacheBudget.h"
+#include "Stats.h"
+
+namespace dfs
+{
+  // In-memory cache of decrypted data cells. It sits above the crypto layer
+  // in Volume so that a hit is served with a memcpy instead of an AES pass.
+  // The cache is write-through: Volume still encrypts and hands every write
+  // down to the block cache, so nothing here needs to be flushed.
+  //
+  // With compression enabled (only when built with LZ4) cells are kept LZ4
+  // compressed and the budget is charged for the compressed size, so the same
+  // memory holds more cells at the cost of a decompression on every hit.
+  // Cells that do not shrink are kept as they are.
+  class PlainCache : public CacheBudget::Consumer
+  {
+  private:
+
+    using Key = std::pair<uint64_t, uint64_t>;
+
+    // Cells share generation counters by hash, a collision only turns a fill away
+    static const size_t GENERATION_SLOTS = 4096;
+
+    struct Entry
+    {
+      Key key;
+      std::unique_ptr<uint8_t[]> data;
+      size_t size;
+      bool compressed;
+    };
+
+  public:
+
+    // The limit is the number of bytes the decrypted cells may take in memory
+    PlainCache(size_t cellSize, uint64_t limit, bool compress = false);
+
+    ~PlainCache() override;
+
+    bool Read(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
+
+    // Stores the plaintext of a cell that is being written
+    void Write(uint64_t row, uint64_t column, const void * buffer);
+
+    // The generation moves whenever a cell is written or invalidated. A reader takes it before it
+    // reads the ciphertext and its fill is only accepted if nothing changed the cell in between.
+    uint64_t Generation(uint64_t row, uint64_t column);
+
+    bool Fill(uint64_t row, uint64_t column, const void * buffer, uint64_t generation);
+
+    void Invalidate(uint64_t row, uint64_t column);
+
+    void SetBudget(uint64_t bytes) override;
+
+    uint64_t TakeGhostHits() override;
+
+    Json::Value GetStats();
+
+  private:
+
+    // Without a generation the store is a write and moves it, with one it is a fill
+    bool Store(uint64_t row, uint64_t column, const void * buffer, const uint64_t * generation);
+
+    uint64_t & GenerationSlot(uint64_t row, uint64_t column);
+
+    void Pop();
+
+    void SetData(Entry & entry, std::unique_ptr<uint8_t[]> data, size_t size, bool compressed);
+
+  private:
+
+    size_t cellSize;
+
+    uint64_t limit;
+
+    bool compress;
+
+    // Bytes the cells take in memory
+    uint64_t usage = 0;
+
+    // Decompression target for hits on compressed cells
+    std::unique_ptr<uint8_t[]> scratch;
+
+    std::list<Entry> entries;
+
+    std::map<Key, std::list<Entry>::iterator> items;
+
+    std::vector<uint64_t> generations;
+
+    GhostList<Key> ghosts;
+
+    uint64_t ghostHits = 0;
+
+    bdfs::Counter hits;
+
+    bdfs::Counter misses;
+
+    bdfs::Counter incompressible;
+
+    std::mutex mutex;
+  };
+}
@@ -23,20 +23,30 @@
 #include "Volume.h"
 #include "Util.h"
 #include "Cache.h"
+#include "PlainCache.h"
+#include "HttpDispatcher.h"
+#include "LatencyTracker.h"
+#include "HedgeBudget.h"
+#include "HostHealth.h"
+#include "HostLimit.h"
+#include "PathRacer.h"
 
 #include <memory.h>
 #include <memory>
+#include <algorithm>
 #include <openssl/sha.h>
 
 namespace dfs
 {
-  Volume::Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password) :
+  Volume::Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password, bool compress) :
     zeroBuffer(NULL),
     volumeId(volumeId),
     blockCount(blockCount),
     dataCount(dataCount),
     codeCount(codeCount),
     blockSize(blockSize),
+    compress(compress),
+    cellSize(compress ? blockSize - CELL_HEADER_SIZE : blockSize),
     partitions(dataCount+codeCount)
   {
     if (password != NULL)
@@ -53,6 +63,7 @@ namespace dfs
 
   Volume::~Volume()
   {
+    this->plainCache.reset();
     this->cache.reset();
     for (std::vector<Partition*>::iterator i = partitions.begin(); i != partitions.end(); i++)
     {
@@ -67,6 +78,12 @@ namespace dfs
   }
 
 
+  void Volume::EnablePlainCache(std::unique_ptr<PlainCache> val)
+  {
+    this->plainCache = std::move(val);
+  }
+
+
   bool Volume::SetPartition(uint64_t index, Partition * partition)
   {
     if (partition == NULL ||
@@ -94,16 +111,86 @@ namespace dfs
   
   uint32_t Volume::GetTimeout() const
   {
+    // This only has to detect a hung device, which the worst case of the
+    // slowest host does without summing over every partition
     uint32_t result = 0;
     for (auto partition : this->partitions)
     {
-      result += partition->GetTimeout();
+      result = std::max(result, partition->GetTimeout());
     }
 
     return result;
   }
 
 
+  // Several sources report on the same host components, their groups are merged key by key
+  static void mergestats(Json::Value & json, const Json::Value & components)
+  {
+    for (const auto & name : components.getMemberNames())
+    {
+      for (const auto & group : components[name].getMemberNames())
+      {
+        for (const auto & key : components[name][group].getMemberNames())
+        {
+          json[name][group][key] = components[name][group][key];
+        }
+      }
+    }
+  }
+
+
+  Json::Value Volume::GetStats()
+  {
+    Json::Value json;
+
+    Json::Value & volume = json["volume"];
+    volume["counters"]["reads"] = Json::Value::UInt(stats.reads.Get());
+    volume["counters"]["writes"] = Json::Value::UInt(stats.writes.Get());
+    volume["counters"]["readBytes"] = Json::Value::UInt(stats.readBytes.Get());
+    volume["counters"]["writeBytes"] = Json::Value::UInt(stats.writeBytes.Get());
+    volume["counters"]["degradedReads"] = Json::Value::UInt(stats.degradedReads.Get());
+    volume["counters"]["mergedReads"] = Json::Value::UInt(stats.mergedReads.Get());
+
+    if (compress)
+    {
+      uint64_t clear = stats.clearBytes.Get();
+      uint64_t stored = stats.storedBytes.Get();
+      volume["counters"]["compressionInBytes"] = Json::Value::UInt(clear);
+      volume["counters"]["compressionOutBytes"] = Json::Value::UInt(stored);
+      volume["gauges"]["compressionRatio"] = stored > 0 ? static_cast<double>(clear) / stored : 1.0;
+    }
+
+    volume["latency"]["read"] = stats.readLatency.ToJson();
+    volume["latency"]["write"] = stats.writeLatency.ToJson();
+
+    if (cache)
+    {
+      json["cache"] = cache->GetStats();
+    }
+
+    if (plainCache)
+    {
+      json["plainCache"] = plainCache->GetStats();
+    }
+
+    // Shared by all volumes of the process
+    json["transport"] = bdfs::HttpDispatcher::GetStats();
+    json["hedging"] = bdfs::HedgeBudget::GetStats();
+
+    Json::Value hosts = bdfs::LatencyTracker::GetStats();
+    for (const auto & name : hosts.getMemberNames())
+    {
+      json[name] = hosts[name];
+    }
+
+    mergestats(json, bdfs::HostHealth::GetStats());
+    mergestats(json, bdfs::HostLimit::GetStats());
+    mergestats(json, bdfs::PathRacer::GetStats());
+
+    return json;
+  }
+
+
   const uint8_t * Volume::GetZeroBuffer()
   {
     if (zeroBuffer == NULL)
@@ -131,6 +218,16 @@ namespace dfs
   bool Volume::WriteEncrypt(const void * buffer, size_t size, size_t offset)
   {
     if (size == 0) { return true; }
+
+    bdfs::ScopedLatency latency(stats.writeLatency);
+    stats.writes.Add();
+    stats.writeBytes.Add(size);
+
+    if (compress)
+    {
+      return __WriteCompressed(buffer, size, offset);
+    }
+
     std::unique_ptr<uint8_t[]> clearBuffer(new uint8_t[blockSize]);
     std::unique_ptr<uint8_t[]> cryptBuffer(new uint8_t[blockSize]);
     uint64_t dataBlock = (uint64_t)(offset / blockSize);
@@ -144,6 +241,8 @@ namespace dfs
     return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
     return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
 
+    RowWrite rowWrite(this, row);
+
     return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
     uint8_t iv[AES_BLOCK_SIZE];
@@ -151,16 +250,30 @@ namespace dfs
     while (true)
     {
       size_t toWrite = (size>blockRemaining)?blockRemaining:size;
-      if (toWrite < blockSize)
+
+      // With CBC a change re-encrypts everything from its AES block to the end of the cell. Without the
+      // whole plaintext at hand only that tail is read, decrypted and written back.
+      size_t begin = 0;
+      if (toWrite < blockSize && (!plainCache || !plainCache->Read(row, col, clearBuffer.get(), blockSize, 0)))
       {
-        return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get(), blockSize, 0), "Error: failed to write [%lx,%lx].\n", row, col);
-        memset(iv, row, AES_BLOCK_SIZE);
-        AES_cbc_encrypt(cryptBuffer.get(), clearBuffer.get(), blockSize, &decryptKey, iv, AES_DECRYPT);
+        return_false_if_msg(!__ReadDecryptRange(row, col, clearBuffer.get(), cryptBuffer.get(), blockOffset, blockSize), "Error: failed to write [%lx,%lx].\n", row, col);
+        begin = blockOffset / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
       }
       memcpy(clearBuffer.get() + blockOffset, byteBuffer, toWrite);
-      memset(iv, row, AES_BLOCK_SIZE);
-      AES_cbc_encrypt(clearBuffer.get(), cryptBuffer.get(), blockSize, &encryptKey, iv, AES_ENCRYPT);
-      return_false_if_msg(!__WriteCached(row, col, cryptBuffer.get(), blockSize, 0), "Error: failed to write [%lx,%lx].\n", row, col);
+      if (begin > 0)
+      {
+        memcpy(iv, cryptBuffer.get() + begin - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+      }
+      else
+      {
+        memset(iv, row, AES_BLOCK_SIZE);
+      }
+      AES_cbc_encrypt(clearBuffer.get() + begin, cryptBuffer.get() + begin, blockSize - begin, &encryptKey, iv, AES_ENCRYPT);
+      return_false_if_msg(!__WriteCached(row, col, cryptBuffer.get() + begin, blockSize - begin, begin), "Error: failed to write [%lx,%lx].\n", row, col);
+      if (plainCache && begin == 0)
+      {
+        plainCache->Write(row, col, clearBuffer.get());
+      }
       byteBuffer += toWrite;
       size -= toWrite;
       blockRemaining = blockSize;
@@ -174,6 +287,7 @@ namespace dfs
 
         col = 0;
         row++;
+        rowWrite.Next(row);
 
         return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
       }
@@ -199,6 +313,8 @@ namespace dfs
     return_false_if_msg(size > (blockCount*dataCount*blockSize), "Error: param 'size' out of range: %ld\n", offset);
     return_false_if_msg((offset+size) > (blockCount*dataCount*blockSize), "Error: param 'offset+size' out of range: %ld\n", offset+size);
 
+    RowWrite rowWrite(this, row);
+
     return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
     while (true)
@@ -218,6 +334,7 @@ namespace dfs
 
         col = 0;
         row++;
+        rowWrite.Next(row);
 
         return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
       }
@@ -232,6 +349,16 @@ namespace dfs
   {
     if (size == 0) { return true; }
 
+    bdfs::ScopedLatency latency(stats.readLatency);
+    stats.reads.Add();
+    stats.readBytes.Add(size);
+
+    if (compress)
+    {
+      return __ReadCompressed(buffer, size, offset);
+    }
+
+
     std::unique_ptr<uint8_t[]> clearBuffer(new uint8_t[blockSize]);
     std::unique_ptr<uint8_t[]> cryptBuffer(new uint8_t[blockSize]);
     uint64_t dataBlock = (uint64_t)(offset / blockSize);
@@ -247,15 +374,23 @@ namespace dfs
 
     return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
 
-    uint8_t iv[AES_BLOCK_SIZE];
-
     while (true)
     {
       size_t toRead = (size>blockRemaining)?blockRemaining:size;
-      return_false_if_msg(!__ReadCached(row, col, cryptBuffer.get(), blockSize, 0), "Error: failed to read [%lx,%lx].\n", row, col);
-      memset(iv, row, AES_BLOCK_SIZE);
-      AES_cbc_encrypt(cryptBuffer.get(), clearBuffer.get(), blockSize, &decryptKey, iv, AES_DECRYPT);
-      memcpy(byteBuffer, clearBuffer.get() + blockOffset, toRead);
+      if (!plainCache || !plainCache->Read(row, col, byteBuffer, toRead, blockOffset))
+      {
+        // The plaintext cache holds whole cells, so a miss there fills it with the whole cell.
+        // Without it partial reads only decrypt, and only make the cache fetch, the range they need.
+        if (plainCache)
+        {
+          return_false_if_msg(!__ReadPlainCell(row, col, clearBuffer.get()), "Error: failed to read [%lx,%lx].\n", row, col);
+        }
+        else
+        {
+          return_false_if_msg(!__ReadDecryptRange(row, col, clearBuffer.get(), cryptBuffer.get(), blockOffset, blockOffset + toRead), "Error: failed to read [%lx,%lx].\n", row, col);
+        }
+        memcpy(byteBuffer, clearBuffer.get() + blockOffset, toRead);
+      }
       byteBuffer += toRead;
       size -= toRead;
       blockRemaining = blockSize;
@@ -362,7 +497,191 @@ namespace dfs
   }
 
 
+  bool Volume::__ReadDecryptRange(uint64_t row, uint64_t column, uint8_t * clear, uint8_t * crypt, size_t begin, size_t end)
+  {
+    // CBC only needs the cipher block in front of a range as its IV, the first block uses the row
+    begin = begin / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+    end = std::min(blockSize, (end + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE);
+
+    size_t from = begin > 0 ? begin - AES_BLOCK_SIZE : 0;
+    return_false_if(!__ReadCached(row, column, crypt + from, end - from, from));
+
+    uint8_t iv[AES_BLOCK_SIZE];
+    if (begin > 0)
+    {
+      memcpy(iv, crypt + from, AES_BLOCK_SIZE);
+    }
+    else
+    {
+      memset(iv, row, AES_BLOCK_SIZE);
+    }
+
+    AES_cbc_encrypt(crypt + begin, clear + begin, end - begin, &decryptKey, iv, AES_DECRYPT);
+
+    return true;
+  }
+
+
+  bool Volume::__ReadPlainCell(uint64_t row, uint64_t column, uint8_t * cell)
+  {
+    // Concurrent misses on a cell wait for the first one and take the cell from the plaintext
+    // cache instead of going through the cell cache and decrypting it again
+    auto key = std::make_pair(row, column);
+    std::shared_ptr<bdfs::AsyncResult<bool>> fill;
+    bool leader = false;
+
+    {
+      std::lock_guard<std::mutex> lock(fillsMutex);
+      auto & entry = fills[key];
+      if (!entry)
+      {
+        entry = std::make_shared<bdfs::AsyncResult<bool>>();
+        leader = true;
+      }
+      fill = entry;
+    }
+
+    if (!leader)
+    {
+      // The leader completes with whether its fill was accepted. If it was turned away because a write
+      // moved the generation, or the cell was evicted again already, the read is repeated here.
+      if (fill->Wait() && fill->GetResult() && plainCache->Read(row, column, cell, cellSize, 0))
+      {
+        stats.mergedReads.Add();
+        return true;
+      }
+    }
+
+    // Taken before the ciphertext is read, so that a write in between keeps the result out of the cache
+    uint64_t generation = plainCache->Generation(row, column);
+
+    bool success = false;
+    if (compress)
+    {
+      success = __ReadClearCell(row, column, cell);
+    }
+    else
+    {
+      std::unique_ptr<uint8_t[]> cryptBuffer(new uint8_t[blockSize]);
+      success = __ReadDecryptRange(row, column, cell, cryptBuffer.get(), 0, blockSize);
+    }
+
+    bool filled = success && plainCache->Fill(row, column, cell, generation);
+
+    if (leader)
+    {
+      {
+        std::lock_guard<std::mutex> lock(fillsMutex);
+        fills.erase(key);
+      }
+
+      fill->Complete(filled);
+    }
+
+    return success;
+  }
+
+
   bool Volume::__ReadCached(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
+  {
+    if (__ReadStored(row, column, buffer, size, offset))
+    {
+      return true;
+    }
+
+    // The host may be down, serve the read from the rest of the row instead of waiting for it. While the
+    // row is being written its parity does not match the data, the read fails then.
+    if (column < dataCount && codeCount > 0 && __BeginDegradedRead(row))
+    {
+      bool success = GetRow(row).Reconstruct(column, buffer, size, offset);
+      __EndDegradedRead(row);
+
+      if (success)
+      {
+        stats.degradedReads.Add();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  Volume::RowWrite::RowWrite(Volume * volume, uint64_t row) :
+    volume(volume),
+    row(row)
+  {
+    volume->__BeginRowWrite(row);
+  }
+
+  Volume::RowWrite::~RowWrite()
+  {
+    volume->__EndRowWrite(row);
+  }
+
+  void Volume::RowWrite::Next(uint64_t next)
+  {
+    volume->__BeginRowWrite(next);
+    volume->__EndRowWrite(row);
+    row = next;
+  }
+
+
+  void Volume::__BeginRowWrite(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(rowsMutex);
+
+    // Writers of a row only ever wait for degraded reads, which cannot start while they are in
+    rowsCond.wait(lock, [this, row]() { return rows[row].readers == 0; });
+    ++rows[row].writers;
+  }
+
+
+  void Volume::__EndRowWrite(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(rowsMutex);
+
+    auto itr = rows.find(row);
+    if (--itr->second.writers == 0 && itr->second.readers == 0)
+    {
+      rows.erase(itr);
+    }
+  }
+
+
+  bool Volume::__BeginDegradedRead(uint64_t row)
+  {
+    std::unique_lock<std::mutex> lock(rowsMutex);
+
+    RowState & state = rows[row];
+    if (state.writers > 0)
+    {
+      printf("Error: row '%lx' is being written, it cannot be reconstructed.\n", row);
+      return false;
+    }
+
+    ++state.readers;
+    return true;
+  }
+
+
+  void Volume::__EndDegradedRead(uint64_t row)
+  {
+    {
+      std::unique_lock<std::mutex> lock(rowsMutex);
+
+      auto itr = rows.find(row);
+      if (--itr->second.readers == 0 && itr->second.writers == 0)
+      {
+        rows.erase(itr);
+      }
+    }
+
+    rowsCond.notify_all();
+  }
+
+
+  bool Volume::__ReadStored(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset)
   {
     if (cache)
     {
@@ -375,12 +694,21 @@ namespace dfs
 
   bool Volume::__WriteCached(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset)
   {
-    if (cache)
+    if (plainCache && column < dataCount)
     {
-      return cache->Write(row, column, buffer, size, offset);
+      // The ciphertext is changing underneath; WriteEncrypt re-populates the entry afterwards.
+      plainCache->Invalidate(row, column);
     }
 
-    return __WriteDirect(row, column, buffer, size, offset);
+    bool success = cache ? cache->Write(row, column, buffer, size, offset) : __WriteDirect(row, column, buffer, size, offset);
+
+    if (plainCache && column < dataCount)
+    {
+      // Turns away fills that read the old ciphertext while it was being replaced
+      plainCache->Invalidate(row, column);
+    }
+
+    return success;
   }
 
 
@@ -394,6 +722,16 @@ namespace dfs
     return partitions[column]->WriteBlock(row, buffer, size, offset);
   }
 
+  bdfs::AsyncResultPtr<ssize_t> Volume::__WriteDirectBatchAsync(uint64_t column, const std::vector<bdfs::BlockExtent> & extents, bdfs::SendBufferPtr body)
+  {
+    return partitions[column]->WriteBlocksAsync(extents, std::move(body));
+  }
+
+  bool Volume::__WaitDirect(uint64_t column, const bdfs::AsyncResultPtr<ssize_t> & result, size_t size)
+  {
+    return partitions[column]->WaitWrite(result, size);
+  }
+
   /*
   bool Volume::GetCellHash(uint64_t blockId, hash_t & hash)
   {
@@ -26,16 +26,22 @@
 #include <stddef.h>
 
 #include "Partition.h"
+#include "Stats.h"
+#include "AsyncResult.h"
 
 #include <string>
 #include <vector>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <condition_variable>
 
 #include <openssl/aes.h>
 
 namespace dfs
 {
   class Cache;
+  class PlainCache;
 
   class Volume
   {
@@ -63,6 +69,9 @@ namespace dfs
       bool Verify();
       bool Decode();
       bool Encode();
+
+      // Rebuilds a range of a data cell in memory from the rest of the row
+      bool Reconstruct(uint64_t column, void * buffer, size_t size, size_t offset);
     };
 
     class Column
@@ -76,9 +85,33 @@ namespace dfs
       Cell GetCell(uint64_t row);
     };
 
+    // Marks a row as being written for as long as it lives. Its parity is stale until the row is
+    // encoded again, so the row may not be reconstructed meanwhile.
+    class RowWrite
+    {
+    private:
+      Volume * volume;
+      uint64_t row;
+    public:
+      RowWrite(Volume * volume, uint64_t row);
+      ~RowWrite();
+      RowWrite(const RowWrite &) = delete;
+      RowWrite & operator=(const RowWrite &) = delete;
+
+      // Moves on to the next row once the current one is encoded
+      void Next(uint64_t next);
+    };
+
+    struct RowState
+    {
+      size_t writers = 0;
+      size_t readers = 0;
+    };
+
     friend class Cell;
     friend class Row;
     friend class Column;
+    friend class RowWrite;
 
   private:
     uint8_t * zeroBuffer;
@@ -87,30 +120,74 @@ namespace dfs
     uint64_t dataCount;
     uint64_t codeCount;
     size_t blockSize;
+    // Data cells of a compressed volume start with a header and hold that much less
+    bool compress;
+    size_t cellSize;
     std::vector<Partition*> partitions;
     AES_KEY encryptKey;
     AES_KEY decryptKey;
 
     std::unique_ptr<Cache> cache;
 
+    std::unique_ptr<PlainCache> plainCache;
+
+    // Plaintext cache misses being filled, keyed by row and column
+    std::mutex fillsMutex;
+    std::map<std::pair<uint64_t, uint64_t>, std::shared_ptr<bdfs::AsyncResult<bool>>> fills;
+
+    // Writers and degraded readers of the rows in use. Writers wait for degraded reads of their row
+    // to finish, degraded reads of a row that is being written fail.
+    std::mutex rowsMutex;
+    std::condition_variable rowsCond;
+    std::map<uint64_t, RowState> rows;
+
+    struct
+    {
+      bdfs::Counter reads;
+      bdfs::Counter writes;
+      bdfs::Counter readBytes;
+      bdfs::Counter writeBytes;
+      bdfs::Counter degradedReads;
+
+      // Plaintext cache misses served by another read of the same cell
+      bdfs::Counter mergedReads;
+
+      // Plaintext written to compressed cells and what was stored for it
+      bdfs::Counter clearBytes;
+      bdfs::Counter storedBytes;
+
+      bdfs::Histogram readLatency;
+      bdfs::Histogram writeLatency;
+    } stats;
+
   public:
-    Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password);
+    // Leads the encrypted payload of every data cell of a compressed volume
+    static const size_t CELL_HEADER_SIZE = AES_BLOCK_SIZE;
+
+    Volume(const char * volumeId, uint64_t dataCount, uint64_t codeCount, uint64_t blockCount, size_t blockSize, const char * password, bool compress = false);
     ~Volume();
 
     bool SetPartition(uint64_t index, Partition * partition);
 
     void EnableCache(std::unique_ptr<Cache> cache);
 
+    void EnablePlainCache(std::unique_ptr<PlainCache> cache);
+
     uint32_t GetTimeout() const;
 
+    // Counters, gauges and latency histograms of the volume and its caches
+    Json::Value GetStats();
+
     const uint64_t Rows() { return blockCount; }
     const uint64_t Columns() { return partitions.size(); }
     const uint64_t DataCount() { return dataCount; }
     const uint64_t CodeCount() { return codeCount; }
     const uint64_t BlockCount() { return blockCount; }
     const size_t BlockSize() { return blockSize; }
+    const size_t CellSize() { return cellSize; }
+    const bool IsCompressed() { return compress; }
 
-    const size_t DataSize() { return dataCount * blockCount * blockSize; }
+    const size_t DataSize() { return dataCount * blockCount * cellSize; }
     const size_t CodeSize() { return codeCount * blockCount * blockSize; }
     const size_t TotalSize() { return (dataCount + codeCount) * blockCount * blockSize; }
 
@@ -132,10 +209,30 @@ namespace dfs
     bool __WriteCell(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
     bool __ReadCell(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
 
+    bool __ReadDecryptRange(uint64_t row, uint64_t column, uint8_t * clear, uint8_t * crypt, size_t begin, size_t end);
+
+    // Reads the whole plaintext of a data cell and adds it to the plaintext cache
+    bool __ReadPlainCell(uint64_t row, uint64_t column, uint8_t * cell);
+
+    // WriteEncrypt and ReadDecrypt of a compressed volume, which only ever handle whole cells
+    bool __WriteCompressed(const void * buffer, size_t size, size_t offset);
+    bool __ReadCompressed(void * buffer, size_t size, size_t offset);
+    bool __WriteClearCell(uint64_t row, uint64_t column, const uint8_t * cell);
+    bool __ReadClearCell(uint64_t row, uint64_t column, uint8_t * cell);
+
+    void __BeginRowWrite(uint64_t row);
+    void __EndRowWrite(uint64_t row);
+    bool __BeginDegradedRead(uint64_t row);
+    void __EndDegradedRead(uint64_t row);
+
     bool __ReadCached(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
+    bool __ReadStored(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
     bool __WriteCached(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
 
     bool __ReadDirect(uint64_t row, uint64_t column, void * buffer, size_t size, size_t offset);
     bool __WriteDirect(uint64_t row, uint64_t column, const void * buffer, size_t size, size_t offset);
+
+    bdfs::AsyncResultPtr<ssize_t> __WriteDirectBatchAsync(uint64_t column, const std::vector<bdfs::BlockExtent> & extents, bdfs::SendBufferPtr body);
+    bool __WaitDirect(uint64_t column, const bdfs::AsyncResultPtr<ssize_t> & result, size_t size);
   };
 }
@@ -0,0 +1,259 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <string.h>
+#include <algorithm>
+#if defined(HAVE_LZ4)
+#include <lz4.h>
+#endif
+#include "Volume.h"
+#include "PlainCache.h"
+#include "EndianUtil.h"
+#include "Util.h"
+
+namespace dfs
+{
+  namespace
+  {
+    // The header of a data cell of a compressed volume, in big endian:
+    // magic, codec, payload length and a reserved word
+    const uint32_t CELL_MAGIC = 0x42445a31;
+
+    const uint32_t CODEC_STORED = 0;
+
+    const uint32_t CODEC_LZ4 = 1;
+
+    // Most cells compress well, their header and payload come in with the first read. The cell
+    // cache does not read ahead on compressed volumes, so only the stored prefix is fetched.
+    const size_t FIRST_READ = 4096;
+  }
+
+
+  bool Volume::__WriteClearCell(uint64_t row, uint64_t column, const uint8_t * cell)
+  {
+    std::unique_ptr<uint8_t[]> clearBuffer(new uint8_t[blockSize]);
+    std::unique_ptr<uint8_t[]> cryptBuffer(new uint8_t[blockSize]);
+
+    uint8_t * payload = clearBuffer.get() + CELL_HEADER_SIZE;
+
+    uint32_t codec = CODEC_STORED;
+    size_t length = cellSize;
+
+#if defined(HAVE_LZ4)
+    // Anything that does not shrink is stored as it is
+    int packed = LZ4_compress_default(reinterpret_cast<const char *>(cell),
+                                      reinterpret_cast<char *>(payload),
+                                      static_cast<int>(cellSize),
+                                      static_cast<int>(cellSize - 1));
+    if (packed > 0)
+    {
+      codec = CODEC_LZ4;
+      length = static_cast<size_t>(packed);
+    }
+#endif
+
+    if (codec == CODEC_STORED)
+    {
+      memcpy(payload, cell, cellSize);
+    }
+
+    uint32_t header[4] = { htobe32(CELL_MAGIC), htobe32(codec), htobe32(static_cast<uint32_t>(length)), 0 };
+    memcpy(clearBuffer.get(), header, CELL_HEADER_SIZE);
+
+    // Only the header and the payload go out, the rest of the cell keeps whatever it held
+    size_t end = (CELL_HEADER_SIZE + length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+    memset(payload + length, 0, end - CELL_HEADER_SIZE - length);
+
+    uint8_t iv[AES_BLOCK_SIZE];
+    memset(iv, row, AES_BLOCK_SIZE);
+    AES_cbc_encrypt(clearBuffer.get(), cryptBuffer.get(), end, &encryptKey, iv, AES_ENCRYPT);
+
+    return_false_if(!__WriteCached(row, column, cryptBuffer.get(), end, 0));
+
+    stats.clearBytes.Add(cellSize);
+    stats.storedBytes.Add(end);
+
+    if (plainCache)
+    {
+      plainCache->Write(row, column, cell);
+    }
+
+    return true;
+  }
+
+
+  bool Volume::__ReadClearCell(uint64_t row, uint64_t column, uint8_t * cell)
+  {
+    std::unique_ptr<uint8_t[]> clearBuffer(new uint8_t[blockSize]);
+    std::unique_ptr<uint8_t[]> cryptBuffer(new uint8_t[blockSize]);
+
+    size_t first = std::min(blockSize, FIRST_READ);
+    return_false_if(!__ReadDecryptRange(row, column, clearBuffer.get(), cryptBuffer.get(), 0, first));
+
+    uint32_t header[4];
+    memcpy(header, clearBuffer.get(), CELL_HEADER_SIZE);
+
+    // A cell that was never written holds no header, it reads as zeros
+    if (be32toh(header[0]) != CELL_MAGIC)
+    {
+      memset(cell, 0, cellSize);
+      return true;
+    }
+
+    uint32_t codec = be32toh(header[1]);
+    size_t length = be32toh(header[2]);
+    return_false_if_msg(length > cellSize, "Error: cell [%lx,%lx] has a corrupt header.\n", row, column);
+
+    if (CELL_HEADER_SIZE + length > first)
+    {
+      return_false_if(!__ReadDecryptRange(row, column, clearBuffer.get(), cryptBuffer.get(), first, CELL_HEADER_SIZE + length));
+    }
+
+    const uint8_t * payload = clearBuffer.get() + CELL_HEADER_SIZE;
+
+    if (codec == CODEC_STORED)
+    {
+      return_false_if_msg(length != cellSize, "Error: cell [%lx,%lx] has a corrupt header.\n", row, column);
+      memcpy(cell, payload, cellSize);
+      return true;
+    }
+
+#if defined(HAVE_LZ4)
+    if (codec == CODEC_LZ4)
+    {
+      int size = LZ4_decompress_safe(reinterpret_cast<const char *>(payload),
+                                     reinterpret_cast<char *>(cell),
+                                     static_cast<int>(length),
+                                     static_cast<int>(cellSize));
+      return_false_if_msg(size != static_cast<int>(cellSize), "Error: failed to decompress cell [%lx,%lx].\n", row, column);
+      return true;
+    }
+#endif
+
+    printf("Error: cell [%lx,%lx] uses unsupported codec %u.\n", row, column, codec);
+    return false;
+  }
+
+
+  bool Volume::__WriteCompressed(const void * buffer, size_t size, size_t offset)
+  {
+    std::unique_ptr<uint8_t[]> cellBuffer(new uint8_t[cellSize]);
+    uint64_t dataBlock = (uint64_t)(offset / cellSize);
+    size_t blockOffset = offset - (dataBlock * cellSize);
+    uint64_t row = dataBlock / dataCount;
+    uint64_t col = dataBlock - (row * dataCount);
+    size_t blockRemaining = cellSize - blockOffset;
+    uint8_t * byteBuffer = (uint8_t*)buffer;
+
+    return_false_if_msg(offset >= DataSize(), "Error: param 'offset' out of range: %ld\n", offset);
+    return_false_if_msg(size > DataSize(), "Error: param 'size' out of range: %ld\n", offset);
+    return_false_if_msg((offset+size) > DataSize(), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+
+    RowWrite rowWrite(this, row);
+
+    return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+
+    while (true)
+    {
+      size_t toWrite = (size>blockRemaining)?blockRemaining:size;
+
+      // The cell is compressed as a whole, a partial write needs the rest of its plaintext
+      if (toWrite < cellSize && (!plainCache || !plainCache->Read(row, col, cellBuffer.get(), cellSize, 0)))
+      {
+        return_false_if_msg(!__ReadClearCell(row, col, cellBuffer.get()), "Error: failed to write [%lx,%lx].\n", row, col);
+      }
+      memcpy(cellBuffer.get() + blockOffset, byteBuffer, toWrite);
+      return_false_if_msg(!__WriteClearCell(row, col, cellBuffer.get()), "Error: failed to write [%lx,%lx].\n", row, col);
+
+      byteBuffer += toWrite;
+      size -= toWrite;
+      blockRemaining = cellSize;
+      blockOffset = 0;
+
+      if (size == 0) { break; }
+
+      if (++col == dataCount)
+      {
+        return_false_if_msg(!GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+
+        col = 0;
+        row++;
+        rowWrite.Next(row);
+
+        return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+      }
+    }
+
+    return_false_if_msg(!GetRow(row).Encode(), "Error: row '%lx' could not be encoded.\n", row);
+
+    return true;
+  }
+
+
+  bool Volume::__ReadCompressed(void * buffer, size_t size, size_t offset)
+  {
+    std::unique_ptr<uint8_t[]> cellBuffer(new uint8_t[cellSize]);
+    uint64_t dataBlock = (uint64_t)(offset / cellSize);
+    size_t blockOffset = offset - (dataBlock * cellSize);
+    uint64_t row = dataBlock / dataCount;
+    uint64_t col = dataBlock - (row * dataCount);
+    size_t blockRemaining = cellSize - blockOffset;
+    uint8_t * byteBuffer = (uint8_t*)buffer;
+
+    return_false_if_msg(offset >= DataSize(), "Error: param 'offset' out of range: %ld\n", offset);
+    return_false_if_msg(size > DataSize(), "Error: param 'size' out of range: %ld\n", offset);
+    return_false_if_msg((offset+size) > DataSize(), "Error: param 'offset+size' out of range: %ld\n", offset+size);
+
+    return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+
+    while (true)
+    {
+      size_t toRead = (size>blockRemaining)?blockRemaining:size;
+      if (!plainCache || !plainCache->Read(row, col, byteBuffer, toRead, blockOffset))
+      {
+        if (plainCache)
+        {
+          return_false_if_msg(!__ReadPlainCell(row, col, cellBuffer.get()), "Error: failed to read [%lx,%lx].\n", row, col);
+        }
+        else
+        {
+          return_false_if_msg(!__ReadClearCell(row, col, cellBuffer.get()), "Error: failed to read [%lx,%lx].\n", row, col);
+        }
+        memcpy(byteBuffer, cellBuffer.get() + blockOffset, toRead);
+      }
+      byteBuffer += toRead;
+      size -= toRead;
+      blockRemaining = cellSize;
+      blockOffset = 0;
+
+      if (size == 0) { break; }
+
+      if (++col == dataCount)
+      {
+        col = 0;
+        row++;
+        return_false_if_msg(!GetRow(row).Verify(), "Error: row '%lx' is corrupt.\n", row);
+      }
+    }
+    return true;
+  }
+}
@@ -75,7 +75,21 @@ namespace dfs
       return nullptr;
     }
 
-    auto volume = std::make_unique<Volume>(name.c_str(), dataBlocks, codeBlocks, blockCount, blockSize, "HelloWorld");
+    // Compression changes the layout of the cells, so it is fixed when the volume is created
+    bool compress = false;
+    if (json.isMember("compression"))
+    {
+#if defined(HAVE_LZ4)
+      compress = json["compression"].isString() && json["compression"].asString() == "lz4";
+#endif
+      if (!compress)
+      {
+        printf("Error: volume '%s' uses a compression this build does not support.\n", name.c_str());
+        return nullptr;
+      }
+    }
+
+    auto volume = std::make_unique<Volume>(name.c_str(), dataBlocks, codeBlocks, blockCount, blockSize, "HelloWorld", compress);
 
     for (size_t i = 0; i < json["partitions"].size(); ++i)
     {
@@ -93,10 +107,18 @@ namespace dfs
 
       auto cfg = new bdfs::HttpConfig();
       cfg->Relays(std::move(ep.relays));
+      cfg->DirectHint(ep.direct);
       auto session = bdfs::BdSession::CreateSession(ep.url.c_str(), cfg, true);
       auto name = config["name"].asString();
       auto path = "host://Partitions/" + name;
-      auto partition = std::static_pointer_cast<bdfs::BdPartition>(session->CreateObject("Partition", path.c_str(), name.c_str()));
+      auto partition = std::static_pointer_cast<bdfs::BdPartition>(session->CreateObject(name.c_str(), path.c_str(), "Partition"));
+
+#if !defined(_WIN32)
+      if (ep.dataPort != 0)
+      {
+        partition->SetBlockClient(bdfs::BlockClient::Get(ep.url, ep.dataPort));
+      }
+#endif
 
       volume->SetPartition(i, new Partition(partition, blockCount, blockSize));
     }
@@ -248,6 +270,7 @@ namespace dfs
 
           auto cfg = new bdfs::HttpConfig();
           cfg->Relays(std::move(ep.relays));
+          cfg->DirectHint(ep.direct);
           providersUsed.emplace(contracts[i]->Provider());
 
           auto session = bdfs::BdSession::CreateSession(ep.url.c_str(), cfg, true);
@@ -314,10 +337,23 @@ namespace dfs
     return volume;
   }
 
-  bool VolumeManager::CreateVolume(const std::string & volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks)
+  bool VolumeManager::CreateVolume(const std::string & volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks, bool compress)
   {
+#if !defined(HAVE_LZ4)
+    if (compress)
+    {
+      printf("Error: compressed volumes need a build with LZ4.\n");
+      return false;
+    }
+#endif
+
     auto volume = CreateVolumePartitions(volumeName, size, dataBlocks, codeBlocks);
 
+    if (compress)
+    {
+      volume["compression"] = "lz4";
+    }
+
     std::string result = volume.toStyledString();
 
     std::string path = GetWorkingDir() + SLASH + volumeName;
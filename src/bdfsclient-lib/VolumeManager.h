@@ -37,7 +37,8 @@ namespace dfs
 
     static Json::Value CreateVolumePartitions(const std::string & volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks);
 
-    static bool CreateVolume(const std::string &volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks);
+    // With compress the cells are LZ4 compressed before they are encrypted
+    static bool CreateVolume(const std::string &volumeName, const uint64_t size, const uint16_t dataBlocks, const uint16_t codeBlocks, bool compress = false);
 
     static bool DeleteVolume(const std::string &name, const std::string &path);
 
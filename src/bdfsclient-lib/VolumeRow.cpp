@@ -24,6 +24,7 @@
 #include "cm256.h"
 #include "gf256.h"
 #include "Util.h"
+#include "Priority.h"
 
 #include <memory.h>
 #include <memory>
@@ -53,6 +54,12 @@ namespace dfs
 
   bool Volume::Row::Decode()
   {
+    // Repairing the row is background work next to the read that found it broken
+    bdfs::PriorityScope scope(bdfs::Priority::Rebuild);
+
+    // Parity is rewritten below, so the row may not be reconstructed meanwhile
+    RowWrite rowWrite(volume, row);
+
     size_t blockSize = volume->BlockSize();
     uint64_t codeCount = volume->CodeCount();
     uint64_t dataCount = volume->DataCount();
@@ -76,7 +83,7 @@ namespace dfs
       blocks[i].Block = dataCell;
       if (volume->__VerifyCell(row, i))
       {
-        return_false_if(!volume->__ReadCached(row, i, dataCell, blockSize, 0));
+        return_false_if(!volume->__ReadStored(row, i, dataCell, blockSize, 0));
         blocks[i].Index = i;
       }
       else
@@ -93,7 +100,7 @@ namespace dfs
         if (volume->__VerifyCell(row, i+dataCount))
         {
           size_t oi = missingBlocks[mi++];
-          return_false_if(!volume->__ReadCached(row, i+dataCount, blocks[oi].Block, blockSize, 0));
+          return_false_if(!volume->__ReadStored(row, i+dataCount, blocks[oi].Block, blockSize, 0));
           blocks[oi].Index = dataCount + i;
           if (mi == missingBlocks.size())
           {
@@ -141,10 +148,12 @@ namespace dfs
 
     cm256_block blocks[256];
 
+    // Parity is only ever computed from stored cells. A cell rebuilt from the parity that is about to be
+    // replaced would carry the old contents of the row into the new parity.
     for (int i = 0; i < dataCount; i++)
     {
       uint8_t * dataCell = dataBuffer.get() + (i * blockSize);
-      volume->__ReadCached(row, i, dataCell, blockSize, 0);
+      return_false_if_msg(!volume->__ReadStored(row, i, dataCell, blockSize, 0), "Error: cell [%lx,%x] is not available, row '%lx' keeps its parity.\n", row, i, row);
       blocks[i].Block = dataCell;
     }
 
@@ -161,4 +170,53 @@ namespace dfs
 
     return true;
   }
+
+  bool Volume::Row::Reconstruct(uint64_t column, void * buffer, size_t size, size_t offset)
+  {
+    size_t blockSize = volume->BlockSize();
+    uint64_t codeCount = volume->CodeCount();
+    uint64_t dataCount = volume->DataCount();
+
+    cm256_encoder_params params;
+    params.BlockBytes = blockSize;
+    params.OriginalCount = dataCount;
+    params.RecoveryCount = codeCount;
+
+    size_t dataSize = dataCount * blockSize;
+    std::unique_ptr<uint8_t[]> dataBuffer(new uint8_t[dataSize]);
+    memset(dataBuffer.get(), 0, dataSize);
+
+    std::vector<uint64_t> missingBlocks;
+
+    cm256_block blocks[256] = {0};
+
+    for (int i = 0; i < dataCount; i++)
+    {
+      blocks[i].Block = dataBuffer.get() + (i * blockSize);
+      blocks[i].Index = i;
+      if (i == column || !volume->__ReadStored(row, i, blocks[i].Block, blockSize, 0))
+      {
+        missingBlocks.push_back(i);
+      }
+    }
+
+    // Nothing is written back, the missing cells are repaired by Decode once their hosts return
+    size_t mi = 0;
+    for (int i = 0; i < codeCount && mi < missingBlocks.size(); i++)
+    {
+      size_t oi = missingBlocks[mi];
+      if (volume->__ReadStored(row, i+dataCount, blocks[oi].Block, blockSize, 0))
+      {
+        blocks[oi].Index = dataCount + i;
+        ++mi;
+      }
+    }
+
+    return_false_if_msg(mi < missingBlocks.size(), "Error: not enough cells to reconstruct [%lx,%lx].\n", row, column);
+    return_false_if_msg(cm256_decode(params, blocks), "Error: failed to decode row '%lx'.\n", row);
+
+    memcpy(buffer, static_cast<uint8_t *>(blocks[column].Block) + offset, size);
+
+    return true;
+  }
 }
@@ -33,6 +33,9 @@
 #include "BdTypes.h"
 #include "BdSession.h"
 #include "Cache.h"
+#include "CacheBudget.h"
+#include "CacheStore.h"
+#include "PlainCache.h"
 #include "Util.h"
 
 #include "cm256.h"
@@ -41,6 +44,7 @@
 #include "devio.h"
 #else
 #include "ubd.h"
+#include "DeviceCacheStore.h"
 #endif
 #include "VolumeManager.cpp"
 
@@ -48,6 +52,8 @@ namespace dfs
 {
   std::map<std::string, VolumeMeta *> ActionHandler::volumeInfo;
   std::map<std::string, bool> ActionHandler::nbdInfo;
+  std::map<std::string, std::string> ActionHandler::cacheDevices;
+  bool ActionHandler::compressCache = false;
   
   // ubd callbacks  
   static size_t xmp_read(void *buf, size_t size, size_t offset, void * context)
@@ -55,7 +61,7 @@ namespace dfs
 #ifdef __APPLE__
     printf("xmp_read: offset=%lld size=%lld\n", offset, size);
     Volume * volume = static_cast<Volume *>(context);
-    if (offset + size > volume->BlockCount() * volume->DataCount() * volume->BlockSize())
+    if (offset + size > volume->DataSize())
     {
       return EINVAL;
     }
@@ -71,7 +77,7 @@ namespace dfs
 #ifdef __APPLE__
     printf("xmp_write: offset=%lld size=%lld\n", offset, size);
     Volume * volume = static_cast<Volume *>(context);
-    if (offset + size > volume->BlockCount() * volume->DataCount() * volume->BlockSize())
+    if (offset + size > volume->DataSize())
     {
       return EINVAL;
     }
@@ -197,12 +203,28 @@ namespace dfs
       return 0;
     }
 
-    // Cache size set to 100MB / (blockSize * (dataCount + codeCount)), flushing every 10 seconds
+    // Cache sizes come from the global byte budgets shared by all bound volumes, flushing every 10 seconds
     std::string cacheDir = GetWorkingDir() + SLASH + name + SLASH + "cache";
-#ifndef __APPLE__
-    volume->EnableCache(std::make_unique<dfs::Cache>(cacheDir, volume.get(), 200, 10));
- #endif
-    volume->EnableCache(std::make_unique<dfs::Cache>(cacheDir, volume.get(), 200, 10));
+    std::unique_ptr<dfs::CacheStore> store;
+#if !defined(_WIN32)
+    auto device = cacheDevices.find(name);
+    if (device != cacheDevices.end())
+    {
+      store = DeviceCacheStore::Open(device->second, name, volume->BlockSize());
+      if (!store)
+      {
+        printf("Falling back to the cache folder for volume '%s'\n", name.c_str());
+      }
+    }
+#endif
+    auto cache = std::make_unique<dfs::Cache>(cacheDir, volume.get(), CacheBudget::InitialBudget(CacheBudget::Kind::Disk), 10, 8, std::move(store));
+    CacheBudget::Register(CacheBudget::Kind::Disk, cache.get());
+    volume->EnableCache(std::move(cache));
+
+    // Keep the most recently used data cells decrypted in memory
+    auto plainCache = std::make_unique<dfs::PlainCache>(volume->CellSize(), CacheBudget::InitialBudget(CacheBudget::Kind::Memory), compressCache);
+    CacheBudget::Register(CacheBudget::Kind::Memory, plainCache.get());
+    volume->EnablePlainCache(std::move(plainCache));
     
 #if defined(_WIN32)
     static struct drv_operations ops;
@@ -249,6 +271,7 @@ namespace dfs
     meta->nbdPath = nbdPath;
     meta->mountPath = path;
     meta->isMounted = meta->isFormatted = false;
+    meta->volume = pVolume;
 
     volumeInfo[name] = meta;
     nbdInfo[nbdPath] = true;
@@ -264,6 +287,8 @@ namespace dfs
     if(it != volumeInfo.end())
     {
       printf("Unbinding volume: %s\n",name.c_str());
+      // The volume is deleted by the cleanup callback once disconnected
+      it->second->volume = nullptr;
 #if defined(_WIN32)
       ActionHandler::Unmount(it->second->mountPath);
       drv_disconnect(name);
@@ -278,6 +303,23 @@ namespace dfs
     return 1;
   }
   
+  std::vector<std::string> ActionHandler::GetVolumeStats(const std::string &name)
+  {
+    std::vector<std::string> result;
+    Json::FastWriter writer;
+
+    for(auto &it : volumeInfo)
+    {
+      if((name.empty() || it.first == name) && it.second->volume)
+      {
+        result.emplace_back(it.first);
+        result.emplace_back(writer.write(it.second->volume->GetStats()));
+      }
+    }
+
+    return result;
+  }
+
   std::string ActionHandler::GetNextNBD()
   {
     for(auto it : ActionHandler::nbdInfo)
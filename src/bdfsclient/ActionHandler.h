@@ -22,9 +22,12 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 namespace dfs
 {
+  class Volume;
+
   struct VolumeMeta 
   {
     std::string volumeName;
@@ -32,12 +35,15 @@ namespace dfs
     std::string mountPath;
     bool isFormatted;
     bool isMounted;
+    Volume * volume;
   };
 
   class ActionHandler
   {
     static std::map<std::string,VolumeMeta*> volumeInfo;
     static std::map<std::string, bool> nbdInfo;
+    static std::map<std::string, std::string> cacheDevices;
+    static bool compressCache;
 
     static std::string GetNextNBD();
     static void Unmount(const std::string &nbdPath, bool matchAll);
@@ -46,12 +52,27 @@ namespace dfs
     static void Cleanup();
     static int BindVolume(const std::string &name, const std::string &path);
     static int UnbindVolume(const std::string &name);
+
+    // Returns name and JSON encoded statistics pairs of the bound volumes, or only of the given one
+    static std::vector<std::string> GetVolumeStats(const std::string &name);
     
     static inline void AddNbdPath(std::string path)
     {
       ActionHandler::nbdInfo[path] = false;
     }
 
+    // Keeps the disk cache of the volume on the given device instead of in files
+    static inline void SetCacheDevice(const std::string &name, const std::string &path)
+    {
+      ActionHandler::cacheDevices[name] = path;
+    }
+
+    // Keeps the decrypted cells in memory LZ4 compressed
+    static inline void SetCompressCache(bool val)
+    {
+      ActionHandler::compressCache = val;
+    }
+
     static inline std::string GetNbdForVolume(const std::string &name)
     {
       return volumeInfo.find(name) != volumeInfo.end() ? volumeInfo[name]->nbdPath : "";
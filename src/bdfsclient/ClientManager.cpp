@@ -145,6 +145,13 @@ namespace dfs
         break;
       }
 
+      case bdcp::QUERY_STATS:
+      {
+        args = ActionHandler::GetVolumeStats(inArgs.size() > 0 ? inArgs[0] : "");
+        status = 1;
+        break;
+      }
+
       default:
         printf("Unhandled instruction of type : %d\n",((bdcp::BdHdr *)buff.get())->type);
     }
@@ -32,6 +32,9 @@
 #include "ClientManager.h"
 #include "VolumeManager.h"
 #include "ActionHandler.h"
+#include "CacheBudget.h"
+#include "HttpDispatcher.h"
+#include "HedgeBudget.h"
 #include "Util.h"
 #include "Paths.h"
 
@@ -68,6 +71,7 @@ void signalHandler(int signum)
   ActionHandler::Cleanup();
   client.Stop();
   VolumeManager::Stop();
+  CacheBudget::Stop();
   exit(signum);
 }
 #endif
@@ -102,10 +106,62 @@ int main(int argc, char * * argv)
     }
   }
 
+  // Cache budgets in megabytes, a per volume limit of 0 leaves volumes bound only by the global one
+  const Json::Value & cache = json["cache"];
+  if (cache.isObject())
+  {
+    const uint64_t mb = 1024 * 1024;
+
+    if (cache["memory"].isIntegral())
+    {
+      uint64_t total = cache["memory"].asUInt() * mb;
+      uint64_t perVolume = cache["volumeMemory"].asUInt() * mb;
+      CacheBudget::Configure(CacheBudget::Kind::Memory, total, perVolume);
+    }
+
+    if (cache["disk"].isIntegral())
+    {
+      uint64_t total = cache["disk"].asUInt() * mb;
+      uint64_t perVolume = cache["volumeDisk"].asUInt() * mb;
+      CacheBudget::Configure(CacheBudget::Kind::Disk, total, perVolume);
+    }
+
+    if (cache["compress"].isBool())
+    {
+      ActionHandler::SetCompressCache(cache["compress"].asBool());
+    }
+
+    // Volumes listed here keep their disk cache on a raw device
+    const Json::Value & devices = cache["devices"];
+    if (devices.isObject())
+    {
+      for (const auto & name : devices.getMemberNames())
+      {
+        ActionHandler::SetCacheDevice(name, devices[name].asString());
+      }
+    }
+  }
+
+  // Requests in flight per storage host and in total
+  const Json::Value & http = json["http"];
+  if (http.isObject())
+  {
+    bdfs::HttpDispatcher::Configure(http["hostConcurrency"].asUInt(), http["concurrency"].asUInt());
+
+    // Share of block reads that may be duplicated when they are slow
+    if (http.isMember("hedgePercent"))
+    {
+      bdfs::HedgeBudget::Configure(http["hedgePercent"].asUInt());
+    }
+  }
+
   if (cm256_init()) {
     exit(1);
   }
 
+  // Started only once nothing can exit early, a running rebalancer must be stopped before exit
+  CacheBudget::Start();
+
 #if defined(_WIN32)
   signal(SIGINT, signalHandler);
   signal(SIGTERM, signalHandler);
@@ -122,6 +178,7 @@ int main(int argc, char * * argv)
   client.Start();
 
   VolumeManager::Stop();
+  CacheBudget::Stop();
 
   printf("bdfsclient server exiting...\n");
   return 0;
@@ -0,0 +1,323 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "BlockServer.h"
+#include "Partition.h"
+
+namespace bdhost
+{
+  using namespace bdfs;
+
+
+  BlockServer::~BlockServer()
+  {
+    this->Stop();
+  }
+
+
+  bool BlockServer::Start(uint16_t port)
+  {
+    this->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (this->fd < 0)
+    {
+      return false;
+    }
+
+    int one = 1;
+    setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(this->fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(this->fd, SOMAXCONN) != 0)
+    {
+      close(this->fd);
+      this->fd = -1;
+      return false;
+    }
+
+    this->running = true;
+    this->acceptor = std::thread(&BlockServer::AcceptProc, this);
+
+    return true;
+  }
+
+
+  void BlockServer::Stop()
+  {
+    if (!this->running.exchange(false))
+    {
+      return;
+    }
+
+    shutdown(this->fd, SHUT_RDWR);
+
+    if (this->acceptor.joinable())
+    {
+      this->acceptor.join();
+    }
+
+    close(this->fd);
+    this->fd = -1;
+  }
+
+
+  void BlockServer::AcceptProc()
+  {
+    while (this->running)
+    {
+      int client = accept(this->fd, nullptr, nullptr);
+      if (client < 0)
+      {
+        if (errno == EINTR || errno == ECONNABORTED)
+        {
+          continue;
+        }
+
+        break;
+      }
+
+      int one = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#if defined(SO_NOSIGPIPE)
+      setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+      std::thread(&BlockServer::ConnectionProc, client).detach();
+    }
+  }
+
+
+  void BlockServer::ConnectionProc(int fd)
+  {
+    Connection connection;
+    connection.fd = fd;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < WORKERS_PER_CONNECTION; ++i)
+    {
+      workers.emplace_back(&BlockServer::WorkerProc, &connection);
+    }
+
+    uint8_t buf[BlockProtocol::REQUEST_HEADER_SIZE];
+
+    while (BlockProtocol::RecvAll(fd, buf, sizeof(buf)))
+    {
+      Request request;
+      BlockProtocol::Decode(buf, request.header);
+
+      if (request.header.magic != BlockProtocol::MAGIC ||
+          request.header.nameLength == 0 ||
+          request.header.size > BlockProtocol::MAX_PAYLOAD)
+      {
+        break;
+      }
+
+      request.name.resize(request.header.nameLength);
+      if (!BlockProtocol::RecvAll(fd, &request.name[0], request.name.size()))
+      {
+        break;
+      }
+
+      if (request.header.op == BlockProtocol::Op::WriteBlock && request.header.size > 0)
+      {
+        request.data.resize(request.header.size);
+        if (!BlockProtocol::RecvAll(fd, &request.data[0], request.data.size()))
+        {
+          break;
+        }
+      }
+
+      std::unique_lock<std::mutex> lock(connection.mutex);
+
+      connection.cond.wait(lock, [&connection]() {
+        return connection.queue.size() < MAX_QUEUED;
+      });
+
+      connection.queue.emplace_back(std::move(request));
+      connection.cond.notify_all();
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(connection.mutex);
+      connection.closed = true;
+    }
+
+    connection.cond.notify_all();
+
+    for (auto & worker : workers)
+    {
+      worker.join();
+    }
+
+    close(fd);
+  }
+
+
+  void BlockServer::WorkerProc(Connection * connection)
+  {
+    std::unique_lock<std::mutex> lock(connection->mutex);
+
+    while (true)
+    {
+      connection->cond.wait(lock, [connection]() {
+        return connection->closed || !connection->queue.empty();
+      });
+
+      if (connection->queue.empty())
+      {
+        return;
+      }
+
+      Request request = std::move(connection->queue.front());
+      connection->queue.pop_front();
+
+      // The reader may be waiting for room in the queue
+      connection->cond.notify_all();
+
+      lock.unlock();
+
+      Process(connection, request);
+
+      lock.lock();
+    }
+  }
+
+
+  void BlockServer::Process(Connection * connection, Request & request)
+  {
+    const BlockProtocol::RequestHeader & header = request.header;
+
+    BlockProtocol::ResponseHeader response;
+    response.magic = BlockProtocol::MAGIC;
+    response.id = header.id;
+    response.status = BlockProtocol::Status::Ok;
+    response.size = 0;
+
+    std::string payload;
+
+    uint64_t blockCount = 0;
+    uint64_t blockSize = 0;
+
+    if (!Partition::LoadConfig(request.name, blockCount, blockSize))
+    {
+      response.status = BlockProtocol::Status::NotFound;
+    }
+    else if (header.block >= blockCount)
+    {
+      response.status = BlockProtocol::Status::InvalidArguments;
+    }
+    else if (header.op == BlockProtocol::Op::ReadBlock)
+    {
+      if (header.offset >= blockSize || header.size > blockSize - header.offset)
+      {
+        response.status = BlockProtocol::Status::InvalidArguments;
+      }
+      else
+      {
+        payload.resize(header.size);
+
+        std::shared_lock<std::shared_timed_mutex> lock(Partition::GetLock(request.name));
+        Partition partition{request.name.c_str(), blockCount, blockSize};
+
+        if (partition.ReadBlock(header.block, &payload[0], header.size, header.offset))
+        {
+          response.size = header.size;
+        }
+        else
+        {
+          payload.clear();
+          response.status = BlockProtocol::Status::Failed;
+        }
+      }
+    }
+    else if (header.op == BlockProtocol::Op::WriteBlock)
+    {
+      if (header.offset >= blockSize || header.size == 0 || header.size > blockSize - header.offset)
+      {
+        response.status = BlockProtocol::Status::InvalidArguments;
+      }
+      else
+      {
+        std::lock_guard<std::shared_timed_mutex> lock(Partition::GetLock(request.name));
+        Partition partition{request.name.c_str(), blockCount, blockSize};
+
+        if (partition.WriteBlock(header.block, request.data.data(), request.data.size(), header.offset))
+        {
+          response.size = header.size;
+        }
+        else
+        {
+          response.status = BlockProtocol::Status::Failed;
+        }
+      }
+    }
+    else if (header.op == BlockProtocol::Op::VerifyBlock)
+    {
+      std::shared_lock<std::shared_timed_mutex> lock(Partition::GetLock(request.name));
+      Partition partition{request.name.c_str(), blockCount, blockSize};
+
+      if (!partition.VerifyBlock(header.block))
+      {
+        response.status = BlockProtocol::Status::Failed;
+      }
+    }
+    else if (header.op == BlockProtocol::Op::DiscardBlock)
+    {
+      std::lock_guard<std::shared_timed_mutex> lock(Partition::GetLock(request.name));
+      Partition partition{request.name.c_str(), blockCount, blockSize};
+
+      if (!partition.DiscardBlock(header.block))
+      {
+        response.status = BlockProtocol::Status::Failed;
+      }
+    }
+    else
+    {
+      response.status = BlockProtocol::Status::NotSupported;
+    }
+
+    uint8_t buf[BlockProtocol::RESPONSE_HEADER_SIZE];
+    BlockProtocol::Encode(response, buf);
+
+    std::lock_guard<std::mutex> lock(connection->sendMutex);
+
+    // A failed send closes the socket for the reader too, which ends the connection
+    if (!BlockProtocol::SendAll(connection->fd, buf, sizeof(buf)) ||
+        (!payload.empty() && !BlockProtocol::SendAll(connection->fd, payload.data(), payload.size())))
+    {
+      shutdown(connection->fd, SHUT_RDWR);
+    }
+  }
+}
@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2018 Drive Foundation
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "BlockProtocol.h"
+
+namespace bdhost
+{
+  // Serves ReadBlock, WriteBlock, VerifyBlock and DiscardBlock over the binary
+  // block protocol on a dedicated port. Each connection has a reader that
+  // parses request frames and a few workers that execute them, so requests
+  // on one connection overlap and their responses go out as they complete.
+  class BlockServer
+  {
+  private:
+
+    struct Request
+    {
+      bdfs::BlockProtocol::RequestHeader header;
+      std::string name;
+      std::string data;
+    };
+
+    struct Connection
+    {
+      int fd;
+      std::mutex sendMutex;
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::deque<Request> queue;
+      bool closed = false;
+    };
+
+  public:
+
+    static const size_t WORKERS_PER_CONNECTION = 4;
+
+    // Requests read ahead of the workers before the reader stops taking more
+    static const size_t MAX_QUEUED = 64;
+
+    ~BlockServer();
+
+    bool Start(uint16_t port);
+
+    void Stop();
+
+  private:
+
+    void AcceptProc();
+
+    static void ConnectionProc(int fd);
+
+    static void WorkerProc(Connection * connection);
+
+    static void Process(Connection * connection, Request & request);
+
+  private:
+
+    int fd = -1;
+
+    std::atomic<bool> running{false};
+
+    std::thread acceptor;
+  };
+}
@@ -34,6 +34,7 @@
 #include "BdKademlia.h"
 #include "RelayManager.h"
 #include "HostInfo.h"
+#include "BlockServer.h"
 #include "Util.h"
 
 void PublishStorage()
@@ -85,10 +86,15 @@ static void init_kad()
         hostInfo.url = buf;
       }
 
+      hostInfo.dataPort = bdhost::Options::dataPort;
+
       bdhost::RelayManager relayManager{bdhost::Options::maxRelayCount};
 
       while (true)
       {
+        hostInfo.direct = bdhost::CheckDirect(hostInfo.url);
+        printf("Endpoint %s is %s.\n", hostInfo.url.c_str(), hostInfo.direct ? "directly reachable" : "only reachable through relays");
+
         relayManager.Validate();
 
         std::vector<const bdfs::RelayInfo *> relays;
@@ -148,8 +154,6 @@ int main(int argc, const char ** argv)
 {
   bdhost::Options::Init(argc, argv);
 
-  init_kad();
-
   bdhttp::HttpModule::Initialize();
 
   bdhttp::HttpServer server;
@@ -160,11 +164,24 @@ int main(int argc, const char ** argv)
     return -1;
   }
 
+  bdhost::BlockServer blockServer;
+
+  if (bdhost::Options::dataPort != 0 && !blockServer.Start(bdhost::Options::dataPort))
+  {
+    printf("[Main]: failed to start block server on port %u.\n", bdhost::Options::dataPort);
+    return -1;
+  }
+
+  // The reachability check calls our own endpoint, so it is only published once the servers run
+  init_kad();
+
   while (server.IsRunning())
   {
     sleep(1);
   }
 
+  blockServer.Stop();
+
   bdhttp::HttpModule::Stop();
 
   return 0;
@@ -30,6 +30,8 @@ namespace bdhost
 {
   uint16_t Options::port = 80;
 
+  uint16_t Options::dataPort = 0;
+
   std::string Options::name;
 
   std::string Options::endpoint;
@@ -63,6 +65,7 @@ namespace bdhost
     printf("Options:\n");
     printf("  -n <name>       name of the host\n");
     printf("  -p <port>       port to listen on (default:80)\n");
+    printf("  -d <port>       port to serve the binary block protocol on (default:0, disabled)\n");
     printf("  -e <url>        endpoint url to register (default:http://localhost)\n");
     printf("  -k <kad>        kademlia service url (default:http://localhost:7800)\n");
     printf("  -s <size>       storage size to publish in bytes (default: 1073741824)\n");
@@ -119,6 +122,11 @@ namespace bdhost
         assert_argument_index(++i, "port");
         port = static_cast<uint16_t>(atoi(argv[i]));
       }
+      else if (strcmp(argv[i], "-d") == 0)
+      {
+        assert_argument_index(++i, "data_port");
+        dataPort = static_cast<uint16_t>(atoi(argv[i]));
+      }
       else if (strcmp(argv[i], "-m") == 0)
       {
         assert_argument_index(++i, "max_relays");
@@ -35,6 +35,8 @@ namespace bdhost
 
     static uint16_t port;
 
+    static uint16_t dataPort;
+
     static std::string endpoint;
 
     static std::vector<std::string> kademlia;
@@ -24,6 +24,8 @@
 #include "Options.h"
 
 #include <memory.h>
+#include <unistd.h>
+#include <memory>
 #include <sys/stat.h>
 
 namespace bdhost
@@ -131,6 +133,61 @@ namespace bdhost
     return true;
   }
 
+  bool Partition::DiscardBlock(uint64_t index)
+  {
+    return_false_if_msg(index >= blockCount, "Error: 'index' is out of range: %ld >= %ld\n", index, blockCount);
+
+    if (partitionMap[index])
+    {
+      char fileName[1024];
+      snprintf(fileName, sizeof(fileName), "%s/block-%lx", partitionPath.c_str(), index);
+      unlink(fileName);
+
+      partitionMap[index] = false;
+
+      FlushMap();
+    }
+
+    return true;
+  }
+
+  bool Partition::LoadConfig(const std::string & partitionId, uint64_t & blockCount, uint64_t & blockSize)
+  {
+    return_false_if(partitionId.empty() || partitionId == "." || partitionId == ".." ||
+                    partitionId.find('/') != std::string::npos);
+
+    std::string namePath = Options::workDir + partitionId;
+
+    struct stat st = {0};
+    return_false_if(stat(namePath.c_str(), &st) != 0 || !S_ISDIR(st.st_mode));
+
+    FILE * config = fopen((namePath + "/.config").c_str(), "r");
+    return_false_if(config == NULL);
+
+    bool found = fread(&blockCount, 1, sizeof(uint64_t), config) == sizeof(uint64_t) &&
+                 fread(&blockSize, 1, sizeof(uint64_t), config) == sizeof(uint64_t);
+
+    fclose(config);
+
+    return found;
+  }
+
+  std::shared_timed_mutex & Partition::GetLock(const std::string & partitionId)
+  {
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<std::shared_timed_mutex>> locks;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto & entry = locks[partitionId];
+    if (!entry)
+    {
+      entry.reset(new std::shared_timed_mutex());
+    }
+
+    return *entry;
+  }
+
   bool Partition::WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset)
   {
     return_false_if_msg(index > blockCount, "Error: 'index' is out of range: %ld >= %ld\n", index, blockCount);
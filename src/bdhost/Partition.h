@@ -25,6 +25,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
 #include "BitSet.h"
 #include "Util.h"
 
@@ -55,5 +58,13 @@ namespace bdhost
     bool InitBlock(uint64_t index);
     bool ReadBlock(uint64_t index, void * buffer, size_t size, size_t offset);
     bool WriteBlock(uint64_t index, const void * buffer, size_t size, size_t offset);
+    bool DiscardBlock(uint64_t index);
+
+    // Reads the geometry stored when the partition was created
+    static bool LoadConfig(const std::string & partitionId, uint64_t & blockCount, uint64_t & blockSize);
+
+    // Requests for a partition may run concurrently, readers share this lock and
+    // anything that changes the block map takes it exclusively
+    static std::shared_timed_mutex & GetLock(const std::string & partitionId);
   };
 }
@@ -27,6 +27,8 @@
 #include <chrono>
 #include <string>
 #include <assert.h>
+#include <vector>
+#include <json/json.h>
 #include "Util.h"
 #include "Options.h"
 #include "HttpHandlerRegister.h"
@@ -42,6 +44,53 @@ namespace bdhost
 
   REGISTER_HTTP_HANDLER(Partition, PATH, new PartitionHandler());
 
+  // Bounds for a single ReadBlocks or WriteBlocks request
+  static const size_t MAX_EXTENTS = 256;
+  static const uint64_t MAX_BATCH_BYTES = 64 * 1024 * 1024;
+
+  struct Extent
+  {
+    uint64_t block;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+
+  // Parses [[block, offset, size], ...] and checks every extent against the partition
+  static bool parseextents(const char * param, uint64_t blockCount, uint64_t blockSize, std::vector<Extent> & extents, uint64_t & total)
+  {
+    Json::Value value;
+    Json::Reader reader;
+    if (!param || !reader.parse(param, value, false) || !value.isArray() || value.size() == 0 || value.size() > MAX_EXTENTS)
+    {
+      return false;
+    }
+
+    total = 0;
+
+    for (Json::Value::ArrayIndex i = 0; i < value.size(); ++i)
+    {
+      const Json::Value & entry = value[i];
+      if (!entry.isArray() || entry.size() != 3 ||
+          !entry[Json::Value::UInt(0)].isIntegral() || !entry[Json::Value::UInt(1)].isIntegral() || !entry[Json::Value::UInt(2)].isIntegral())
+      {
+        return false;
+      }
+
+      Extent extent = { entry[Json::Value::UInt(0)].asUInt(), entry[Json::Value::UInt(1)].asUInt(), entry[Json::Value::UInt(2)].asUInt() };
+      if (extent.block >= blockCount || extent.offset >= blockSize || extent.size == 0 || extent.size > blockSize - extent.offset)
+      {
+        return false;
+      }
+
+      total += extent.size;
+      extents.emplace_back(extent);
+    }
+
+    return total <= MAX_BATCH_BYTES;
+  }
+
+
   void PartitionHandler::ProcessRequest(bdhttp::HttpContext & context)
   {
     std::string path = context.path();
@@ -198,32 +247,10 @@ namespace bdhost
 
   void PartitionHandler::OnPartitionRequest(bdhttp::HttpContext & context, const std::string & name, const std::string & action)
   {
-    bool found = false;
-    struct stat st = {0};
     uint64_t blockCount = 0;
     uint64_t blockSize = 0;
 
-    if (!name.empty() && name != "." && name != "..")
-    {
-      std::string namePath = Options::workDir + name;
-      if (stat(namePath.c_str(), &st) == 0)
-      {
-        if (S_ISDIR(st.st_mode))
-        {
-          FILE * config = fopen((namePath + "/.config").c_str(), "r");
-          if (config)
-          {
-            if (fread(&blockCount, 1, sizeof(uint64_t), config) == sizeof(uint64_t) &&
-                fread(&blockSize, 1, sizeof(uint64_t), config) == sizeof(uint64_t))
-            {
-              found = true;
-            }
-
-            fclose(config);
-          }
-        }
-      }
-    }
+    bool found = Partition::LoadConfig(name, blockCount, blockSize);
 
     if (!found)
     {
@@ -246,6 +273,22 @@ namespace bdhost
     {
       this->OnWriteBlock(context, name, blockCount, blockSize);
     }
+    else if (action == "ReadBlocks")
+    {
+      this->OnReadBlocks(context, name, blockCount, blockSize);
+    }
+    else if (action == "WriteBlocks")
+    {
+      this->OnWriteBlocks(context, name, blockCount, blockSize);
+    }
+    else if (action == "VerifyBlock")
+    {
+      this->OnVerifyBlock(context, name, blockCount, blockSize);
+    }
+    else if (action == "DiscardBlock")
+    {
+      this->OnDiscardBlock(context, name, blockCount, blockSize);
+    }
     else if (action == "Delete")
     {
       this->OnDelete(context, name);
@@ -274,6 +317,7 @@ namespace bdhost
     uint8_t * buffer = new uint8_t[size];
     memset(buffer, 0, size);
 
+    std::shared_lock<std::shared_timed_mutex> lock(Partition::GetLock(name));
     Partition partition{name.c_str(), blockCount, blockSize};
 
     if (partition.ReadBlock(blockId, buffer, size, offset))
@@ -305,6 +349,7 @@ namespace bdhost
       return;
     }
 
+    std::lock_guard<std::shared_timed_mutex> lock(Partition::GetLock(name));
     Partition partition{name.c_str(), blockCount, blockSize};
     if (partition.WriteBlock(blockId, data, size, offset))
     {
@@ -320,6 +365,112 @@ namespace bdhost
   }
 
 
+  void PartitionHandler::OnReadBlocks(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize)
+  {
+    std::vector<Extent> extents;
+    uint64_t total = 0;
+
+    if (!parseextents(context.parameter("extents"), blockCount, blockSize, extents, total))
+    {
+      context.setResponseCode(500);
+      context.writeError("Failed", "Invalid arguments", bdhttp::ErrorCode::ARGUMENT_INVALID);
+      return;
+    }
+
+    std::vector<uint8_t> buffer(total);
+    uint8_t * ptr = buffer.data();
+
+    std::shared_lock<std::shared_timed_mutex> lock(Partition::GetLock(name));
+    Partition partition{name.c_str(), blockCount, blockSize};
+
+    for (const auto & extent : extents)
+    {
+      if (!partition.ReadBlock(extent.block, ptr, extent.size, extent.offset))
+      {
+        context.setResponseCode(500);
+        context.writeError("Failed", "Failed to read block", bdhttp::ErrorCode::GENERIC_ERROR);
+        return;
+      }
+
+      ptr += extent.size;
+    }
+
+    context.addResponseHeader("Content-Type", "application/octet-stream");
+    context.writeResponse(buffer.data(), buffer.size());
+  }
+
+
+  void PartitionHandler::OnWriteBlocks(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize)
+  {
+    std::vector<Extent> extents;
+    uint64_t total = 0;
+    const uint8_t * data = static_cast<const uint8_t *>(context.body());
+
+    if (!parseextents(context.parameter("extents"), blockCount, blockSize, extents, total) ||
+        !data || context.bodylen() != total)
+    {
+      context.setResponseCode(500);
+      context.writeError("Failed", "Invalid arguments", bdhttp::ErrorCode::ARGUMENT_INVALID);
+      return;
+    }
+
+    std::lock_guard<std::shared_timed_mutex> lock(Partition::GetLock(name));
+    Partition partition{name.c_str(), blockCount, blockSize};
+
+    for (const auto & extent : extents)
+    {
+      if (!partition.WriteBlock(extent.block, data, extent.size, extent.offset))
+      {
+        context.setResponseCode(500);
+        context.writeError("Failed", "Failed to write block", bdhttp::ErrorCode::GENERIC_ERROR);
+        return;
+      }
+
+      data += extent.size;
+    }
+
+    char sizeStr[64];
+    sprintf(sizeStr, "%llu", (unsigned long long)total);
+    context.writeResponse(sizeStr);
+  }
+
+
+  void PartitionHandler::OnVerifyBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize)
+  {
+    uint64_t blockId = static_cast<uint64_t>(strtoull(context.parameter("block"), nullptr, 10));
+
+    if (blockId >= blockCount)
+    {
+      context.setResponseCode(500);
+      context.writeError("Failed", "Invalid arguments", bdhttp::ErrorCode::ARGUMENT_INVALID);
+      return;
+    }
+
+    std::shared_lock<std::shared_timed_mutex> lock(Partition::GetLock(name));
+    Partition partition{name.c_str(), blockCount, blockSize};
+
+    context.writeResponse(partition.VerifyBlock(blockId) ? "true" : "false");
+  }
+
+
+  void PartitionHandler::OnDiscardBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize)
+  {
+    uint64_t blockId = static_cast<uint64_t>(strtoull(context.parameter("block"), nullptr, 10));
+
+    if (blockId >= blockCount)
+    {
+      context.setResponseCode(500);
+      context.writeError("Failed", "Invalid arguments", bdhttp::ErrorCode::ARGUMENT_INVALID);
+      return;
+    }
+
+    std::lock_guard<std::shared_timed_mutex> lock(Partition::GetLock(name));
+    Partition partition{name.c_str(), blockCount, blockSize};
+
+    context.writeResponse(partition.DiscardBlock(blockId) ? "true" : "false");
+  }
+
+
   void PartitionHandler::OnDelete(bdhttp::HttpContext & context, const std::string & name)
   {
     // TODO: release the reference to contract
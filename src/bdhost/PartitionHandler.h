@@ -42,6 +42,14 @@ namespace bdhost
 
     void OnWriteBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
 
+    void OnReadBlocks(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
+
+    void OnWriteBlocks(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
+
+    void OnVerifyBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
+
+    void OnDiscardBlock(bdhttp::HttpContext & context, const std::string & name, uint64_t blockCount, uint64_t blockSize);
+
     void OnDelete(bdhttp::HttpContext & context, const std::string & name);
 
     void OnCreatePartition(bdhttp::HttpContext & context);
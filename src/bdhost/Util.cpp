@@ -28,6 +28,8 @@
 
 #include "Options.h"
 #include "Util.h"
+#include "HttpConfig.h"
+#include "HttpRequest.h"
 
 namespace bdhost
 {
@@ -130,4 +132,54 @@ namespace bdhost
     id_out << json.toStyledString();
     id_out.close();
   }
+
+
+  static bool isprivate(const std::string & host)
+  {
+    if (host.empty() || host == "localhost")
+    {
+      return true;
+    }
+
+    struct in_addr addr;
+    if (inet_pton(AF_INET, host.c_str(), &addr) != 1)
+    {
+      // A name is resolved by the clients, assume it points somewhere public
+      return false;
+    }
+
+    uint32_t ip = ntohl(addr.s_addr);
+    return (ip >> 24) == 127 ||
+           (ip >> 24) == 10 ||
+           (ip >> 16) == ((192 << 8) | 168) ||
+           (ip >> 20) == ((172 << 4) | 1) ||
+           (ip >> 16) == ((169 << 8) | 254);
+  }
+
+
+  bool CheckDirect(const std::string & url)
+  {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of(":/?#", start);
+    std::string host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+    if (isprivate(host))
+    {
+      return false;
+    }
+
+    bdfs::HttpConfig config;
+    config.ConnectTimeout(5);
+    config.RequestTimeout(5);
+
+    // Any answer will do, even an error page shows the endpoint is reachable
+    bool reachable = false;
+    bdfs::HttpRequest request((url + "/").c_str(), &config);
+    request.Get([&reachable](std::string &&, bool error) { reachable = !error; });
+    request.Execute();
+
+    return reachable;
+  }
 }
@@ -40,4 +40,9 @@ namespace bdhost
   uint64_t GetReservedSpace(std::string reserve_id = "");
   std::string ReserveSpace(const uint64_t size);
   void UnreserveSpace(const std::string & reserve_id);
+
+  // Whether clients can likely reach the endpoint without a relay: it has a
+  // public address and answers when the host calls it by that address. A NAT
+  // that loops its own traffic back can still fool it, clients verify anyway.
+  bool CheckDirect(const std::string & url);
 }
@@ -0,0 +1,243 @@
+#! /usr/bin/env python3
+
+# Exercises the binary block protocol bdhost serves on its data port (-d).
+#
+# usage: block_protocol_test.py <port> <partition_dir>
+#        block_protocol_test.py <port> --expect-closed
+#
+# The partition is only touched at blocks that are unallocated when the test
+# starts, and every block written is discarded again before it exits.
+
+import os
+import random
+import socket
+import struct
+import sys
+
+MAGIC = 0x42444250
+
+OP_READ = 1
+OP_WRITE = 2
+OP_VERIFY = 3
+OP_DISCARD = 4
+
+STATUS_OK = 0
+STATUS_NOT_FOUND = 1
+STATUS_INVALID_ARGUMENTS = 2
+
+REQUEST = struct.Struct('>IIBBxxQII')
+RESPONSE = struct.Struct('>IIiI')
+
+PIPELINE_DEPTH = 32
+
+failures = 0
+
+
+def check(cond, msg):
+  global failures
+  if cond:
+    print('  ok: %s' % msg)
+  else:
+    print('  FAILED: %s' % msg)
+    failures += 1
+
+
+class Client:
+
+  def __init__(self, port):
+    self.sock = socket.create_connection(('127.0.0.1', port), timeout=30)
+    self.nextId = 1
+
+  def close(self):
+    self.sock.close()
+
+  def send(self, op, name, block, offset=0, size=0, data=b''):
+    reqId = self.nextId
+    self.nextId += 1
+    nameBytes = name.encode()
+    if op == OP_WRITE:
+      size = len(data)
+    self.sock.sendall(REQUEST.pack(MAGIC, reqId, op, len(nameBytes), block, offset, size) + nameBytes + data)
+    return reqId
+
+  def recvAll(self, size):
+    buf = b''
+    while len(buf) < size:
+      chunk = self.sock.recv(size - len(buf))
+      if not chunk:
+        raise IOError('connection closed by host')
+      buf += chunk
+    return buf
+
+  # Returns (id, status, payload); ReadBlock responses carry their data
+  def recv(self, op):
+    magic, reqId, status, size = RESPONSE.unpack(self.recvAll(RESPONSE.size))
+    if magic != MAGIC:
+      raise IOError('bad response magic %08x' % magic)
+    payload = b''
+    if op == OP_READ and status == STATUS_OK:
+      payload = self.recvAll(size)
+    return reqId, status, payload
+
+  def call(self, op, name, block, offset=0, size=0, data=b''):
+    reqId = self.send(op, name, block, offset, size, data)
+    respId, status, payload = self.recv(op)
+    if respId != reqId:
+      raise IOError('unexpected response id %d for request %d' % (respId, reqId))
+    return status, payload
+
+
+def loadConfig(path):
+  with open(os.path.join(path, '.config'), 'rb') as f:
+    return struct.unpack('=QQ', f.read(16))
+
+
+def freeBlocks(path, blockCount, count):
+  blocks = []
+  for block in range(blockCount):
+    if not os.path.exists(os.path.join(path, 'block-%x' % block)):
+      blocks.append(block)
+      if len(blocks) == count:
+        break
+  return blocks
+
+
+def testRoundTrips(client, name, blockCount, blockSize, block):
+  print('round trips on block %d' % block)
+
+  data = os.urandom(blockSize)
+  status, _ = client.call(OP_WRITE, name, block, 0, data=data)
+  check(status == STATUS_OK, 'write full block')
+
+  status, payload = client.call(OP_READ, name, block, 0, blockSize)
+  check(status == STATUS_OK and payload == data, 'read full block')
+
+  offset = min(123, blockSize - 1)
+  patch = os.urandom(min(4000, blockSize - offset))
+  status, _ = client.call(OP_WRITE, name, block, offset, data=patch)
+  check(status == STATUS_OK, 'write at unaligned offset %d' % offset)
+
+  expected = data[:offset] + patch + data[offset + len(patch):]
+  status, payload = client.call(OP_READ, name, block, 0, blockSize)
+  check(status == STATUS_OK and payload == expected, 'read back around the partial write')
+
+  status, payload = client.call(OP_READ, name, block, offset, len(patch))
+  check(status == STATUS_OK and payload == patch, 'read at unaligned offset')
+
+  status, _ = client.call(OP_VERIFY, name, block)
+  check(status == STATUS_OK, 'verify written block')
+
+  status, _ = client.call(OP_DISCARD, name, block)
+  check(status == STATUS_OK, 'discard block')
+
+  status, payload = client.call(OP_READ, name, block, 0, blockSize)
+  check(status == STATUS_OK and payload == bytes(blockSize), 'discarded block reads as zeros')
+
+  status, _ = client.call(OP_VERIFY, name, block)
+  check(status == STATUS_OK, 'verify discarded block')
+
+
+def testErrors(client, name, blockCount, blockSize):
+  print('errors')
+
+  status, _ = client.call(OP_READ, name, blockCount, 0, 1)
+  check(status == STATUS_INVALID_ARGUMENTS, 'read past the last block')
+
+  status, _ = client.call(OP_READ, name, 0, blockSize, 1)
+  check(status == STATUS_INVALID_ARGUMENTS, 'read past the end of a block')
+
+  status, _ = client.call(OP_READ, 'no-such-partition', 0, 0, 1)
+  check(status == STATUS_NOT_FOUND, 'read from an unknown partition')
+
+  # The connection has to stay usable after failed requests
+  status, _ = client.call(OP_VERIFY, name, 0)
+  check(status == STATUS_OK, 'connection survives errors')
+
+
+def testPipelined(client, name, blockSize, blocks):
+  print('pipelined requests on %d blocks' % len(blocks))
+
+  size = min(blockSize, 64 * 1024)
+  data = {}
+  pending = {}
+  for block in blocks:
+    data[block] = os.urandom(size)
+    pending[client.send(OP_WRITE, name, block, 0, data=data[block])] = block
+
+  ok = True
+  for _ in range(len(blocks)):
+    reqId, status, _ = client.recv(OP_WRITE)
+    ok = ok and pending.pop(reqId, None) is not None and status == STATUS_OK
+  check(ok and not pending, 'every pipelined write answered once')
+
+  # Reads of different sizes so that the host has a reason to finish them out of order
+  order = list(blocks)
+  random.shuffle(order)
+  sizes = {}
+  sent = []
+  for block in order:
+    sizes[block] = random.randint(1, size)
+    reqId = client.send(OP_READ, name, block, 0, sizes[block])
+    pending[reqId] = block
+    sent.append(reqId)
+
+  ok = True
+  received = []
+  for _ in range(len(order)):
+    reqId, status, payload = client.recv(OP_READ)
+    block = pending.pop(reqId, None)
+    received.append(reqId)
+    ok = ok and block is not None and status == STATUS_OK and payload == data[block][:sizes[block]]
+  check(ok and not pending, 'pipelined reads matched to their requests by id')
+
+  if received != sent:
+    print('  note: responses arrived out of order')
+
+  for block in blocks:
+    client.send(OP_DISCARD, name, block)
+  ok = True
+  for _ in range(len(blocks)):
+    _, status, _ = client.recv(OP_DISCARD)
+    ok = ok and status == STATUS_OK
+  check(ok, 'pipelined discards')
+
+
+def main():
+  if len(sys.argv) != 3:
+    print('usage: %s <port> <partition_dir>|--expect-closed' % sys.argv[0])
+    return 2
+
+  port = int(sys.argv[1])
+
+  if sys.argv[2] == '--expect-closed':
+    try:
+      Client(port).close()
+      check(False, 'data port %d is closed' % port)
+    except ConnectionRefusedError:
+      check(True, 'data port %d is closed' % port)
+    return 1 if failures else 0
+
+  path = sys.argv[2].rstrip('/')
+  name = os.path.basename(path)
+  blockCount, blockSize = loadConfig(path)
+  print('partition %s: %d blocks of %d bytes' % (name, blockCount, blockSize))
+
+  blocks = freeBlocks(path, blockCount, PIPELINE_DEPTH + 1)
+  if not blocks:
+    print('FAILED: no unallocated block to test with')
+    return 1
+
+  client = Client(port)
+  try:
+    testRoundTrips(client, name, blockCount, blockSize, blocks[0])
+    testErrors(client, name, blockCount, blockSize)
+    if len(blocks) > 1:
+      testPipelined(client, name, blockSize, blocks[1:])
+  finally:
+    client.close()
+
+  return 1 if failures else 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
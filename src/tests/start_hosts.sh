@@ -1,5 +1,11 @@
 #! /bin/bash
 
+# Pass -d to also serve the binary block protocol on port 5000+id
+dataPorts=0
+if [[ "$1" == "-d" ]]; then
+  dataPorts=1
+fi
+
 id=0;
 
 while [[ $id -lt 8 ]]; do
@@ -10,7 +16,13 @@ while [[ $id -lt 8 ]]; do
 
   hostIP=`ip addr | grep 'state UP' -A2 | tail -n1 | awk '{print $2}' | cut -f1  -d'/'`
 
-  ./bdhost -p $port -n host-$id -e "http://$hostIP:$port" -k "http://localhost:7800" -w "host-$id" -s 1000000000 &
+  dataArgs=""
+  if [[ $dataPorts -eq 1 ]]; then
+    let dataPort=$id+5000
+    dataArgs="-d $dataPort"
+  fi
+
+  ./bdhost -p $port -n host-$id -e "http://$hostIP:$port" -k "http://localhost:7800" -w "host-$id" -s 1000000000 $dataArgs &
 
   let id=$id+1
 
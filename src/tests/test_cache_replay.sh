@@ -0,0 +1,66 @@
+#! /bin/bash
+
+# Kills the daemon while the disk cache still holds dirty data and checks
+# that the cache index and journal bring it back on the next start.
+#
+# usage: ./test_cache_replay.sh <mount_dir>
+
+target=$1
+
+if [[ -z "$target" ]]; then
+  echo "usage: $0 <mount_dir>"
+  exit 1
+fi
+
+fail() {
+  echo "FAILED: $1"
+  exit 1
+}
+
+./cleanup.sh
+./start_kad.sh
+./start_hosts.sh
+sleep 2
+./create_contracts.sh
+
+./start_daemon.sh &
+sleep 2
+
+./drive create -n volume -k "http://localhost:7800" -s 268435456 -d 4 -c 4
+./format_volume.sh
+mkdir -p $target
+./mount_volume.sh $target
+
+head -c 16777216 /dev/urandom > $target/replay
+sync
+expected=`md5sum < $target/replay`
+
+# The flusher runs every 10 seconds, so most of the file is still dirty here
+./drive stats -n volume
+pkill -9 bdfsclient
+
+sudo umount -l $target
+
+./start_daemon.sh &
+sleep 2
+
+./mount_volume.sh $target
+
+[[ "`md5sum < $target/replay`" == "$expected" ]] || fail "data lost after an unclean stop"
+
+# A second unclean stop right after the replay must not lose it either
+pkill -9 bdfsclient
+sudo umount -l $target
+
+./start_daemon.sh &
+sleep 2
+
+./mount_volume.sh $target
+
+[[ "`md5sum < $target/replay`" == "$expected" ]] || fail "data lost after a second unclean stop"
+
+./unmount_volume.sh
+./delete_volume.sh
+pkill bdfsclient
+
+echo "PASSED"
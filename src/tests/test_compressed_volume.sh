@@ -0,0 +1,71 @@
+#! /bin/bash
+
+# Writes to a compressed volume at offsets and sizes that never line up with
+# its cells and compares the result with the same writes applied to a file.
+#
+# usage: ./test_compressed_volume.sh <mount_dir>
+
+target=$1
+
+if [[ -z "$target" ]]; then
+  echo "usage: $0 <mount_dir>"
+  exit 1
+fi
+
+fail() {
+  echo "FAILED: $1"
+  exit 1
+}
+
+./cleanup.sh
+./start_kad.sh
+./start_hosts.sh
+sleep 2
+./create_contracts.sh
+
+./start_daemon.sh &
+sleep 2
+
+./drive create -n volume -k "http://localhost:7800" -s 268435456 -d 4 -c 4 -z
+./format_volume.sh
+mkdir -p $target
+./mount_volume.sh $target
+
+reference=`mktemp`
+
+# Half compressible, half random so that cells shrink by different amounts
+yes "drive compressed volume" | head -c 4194304 > $reference
+head -c 4194304 /dev/urandom >> $reference
+cp $reference $target/data
+sync
+
+# offset:size pairs, none of them sector aligned
+for write in 1:1 4095:2 65535:4097 131073:300000 1048573:65539 4194000:1000 6000001:777777 8388607:1; do
+  offset=${write%%:*}
+  size=${write##*:}
+
+  patch=`mktemp`
+  head -c $size /dev/urandom > $patch
+
+  dd if=$patch of=$reference bs=1 seek=$offset conv=notrunc status=none
+  dd if=$patch of=$target/data bs=1 seek=$offset conv=notrunc status=none
+  rm -f $patch
+done
+sync
+
+cmp $reference $target/data || fail "partial writes before rebinding"
+
+# Rebinding drops the page cache so the reads go through the volume again
+./unmount_volume.sh
+sleep 2
+./mount_volume.sh $target
+
+cmp $reference $target/data || fail "partial writes after rebinding"
+
+rm -f $reference
+
+./unmount_volume.sh
+./delete_volume.sh
+pkill bdfsclient
+
+echo "PASSED"
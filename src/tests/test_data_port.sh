@@ -0,0 +1,68 @@
+#! /bin/bash
+
+# Runs the block protocol against the hosts' data ports, then checks that a
+# volume keeps working over HTTP once the data ports go away.
+#
+# usage: ./test_data_port.sh <mount_dir>
+
+target=$1
+
+if [[ -z "$target" ]]; then
+  echo "usage: $0 <mount_dir>"
+  exit 1
+fi
+
+fail() {
+  echo "FAILED: $1"
+  exit 1
+}
+
+./cleanup.sh
+./start_kad.sh
+./start_hosts.sh -d
+sleep 2
+./create_contracts.sh
+
+./start_daemon.sh &
+sleep 2
+
+./drive create -n volume -k "http://localhost:7800" -s 268435456 -d 4 -c 4
+
+partition=`find host-0 -mindepth 2 -maxdepth 2 -name .config | head -n1 | xargs -r dirname`
+[[ -n "$partition" ]] || fail "volume has no partition on host-0"
+
+python3 block_protocol_test.py 5000 "$partition" || fail "block protocol"
+
+./format_volume.sh
+mkdir -p $target
+./mount_volume.sh $target
+
+head -c 8388608 /dev/urandom > $target/before
+sync
+before=`md5sum < $target/before`
+
+# Bring the hosts back without data ports while the volume stays bound
+pkill -9 bdhost
+sleep 1
+./start_hosts.sh
+sleep 2
+
+python3 block_protocol_test.py 5000 --expect-closed || fail "data port still open"
+
+head -c 8388608 /dev/urandom > $target/after
+sync
+after=`md5sum < $target/after`
+
+# Rebinding drops the page cache and makes the daemon flush and reload over HTTP
+./unmount_volume.sh
+sleep 2
+./mount_volume.sh $target
+
+[[ "`md5sum < $target/before`" == "$before" ]] || fail "data written over the data port"
+[[ "`md5sum < $target/after`" == "$after" ]] || fail "data written over the HTTP fallback"
+
+./unmount_volume.sh
+./delete_volume.sh
+pkill bdfsclient
+
+echo "PASSED"